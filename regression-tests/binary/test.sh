@@ -0,0 +1,27 @@
+#!/bin/bash
+# Round-trip a WIF through the binary read-matrix format and make sure sahap reads it back.
+USAGE=' '
+REG_DIR=${REG_DIR:?"needs to be set"}
+TMPDIR=`mktemp -d /tmp/sahap-binary.XXXXXX`
+trap "/bin/rm -rf $TMPDIR; exit" 0 1 2 3 15
+
+NUM_FAILS=0
+WIF=data/500SNPs_30x/Model_14.wif
+
+./sahap.MEC convert $WIF $TMPDIR/reads.bin > $REG_DIR/convert.out || { echo "convert failed"; (( ++NUM_FAILS )); }
+./sahap.MEC $TMPDIR/reads.bin data/500SNPs_30x/Model_14.txt 1 > $REG_DIR/binary.out 2>&1
+if fgrep -q 'Mapped 150 reads over 486 sites' $REG_DIR/binary.out && fgrep -q '(100.0' $REG_DIR/binary.out; then
+    echo "binary input: OK"
+else
+    echo "binary input: FAIL"; (( ++NUM_FAILS ))
+fi
+
+# Flip a byte in the payload; the checksum must catch it
+cp $TMPDIR/reads.bin $TMPDIR/corrupt.bin
+printf '\x07' | dd of=$TMPDIR/corrupt.bin bs=1 seek=5000 conv=notrunc 2>/dev/null
+if ./sahap.MEC $TMPDIR/corrupt.bin 2>&1 | fgrep -q 'checksum mismatch'; then
+    echo "corrupt binary input: OK"
+else
+    echo "corrupt binary input: FAIL"; (( ++NUM_FAILS ))
+fi
+exit $NUM_FAILS
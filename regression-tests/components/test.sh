@@ -0,0 +1,21 @@
+#!/bin/bash
+# Two copies of a data set far apart share no sites, so they must be annealed as separate groups.
+USAGE=' '
+REG_DIR=${REG_DIR:?"needs to be set"}
+TMPDIR=`mktemp -d /tmp/sahap-components.XXXXXX`
+trap "/bin/rm -rf $TMPDIR; exit" 0 1 2 3 15
+
+NUM_FAILS=0
+WIF=data/500SNPs_30x/Model_14.wif
+
+# Second copy: every site position moved 10M to the right
+(cat $WIF; awk '{for(i=1;i<=NF;i++)if($(i+1)~/^[ACGT]$/ && $i~/^[0-9]+$/)$i+=10000000; print}' $WIF) > $TMPDIR/two.wif
+paste -d '' data/500SNPs_30x/Model_14.txt data/500SNPs_30x/Model_14.txt > $TMPDIR/two.txt
+./sahap.MEC --threads 2 $TMPDIR/two.wif $TMPDIR/two.txt 1 > $REG_DIR/components.out 2>&1
+if fgrep -q 'Optimizing 2 groups of independent reads on 2 threads' $REG_DIR/components.out &&
+    fgrep -q '(100.0' $REG_DIR/components.out && fgrep -q 'BLOCK 2' $REG_DIR/components.out; then
+    echo "independent components: OK"
+else
+    echo "independent components: FAIL"; (( ++NUM_FAILS ))
+fi
+exit $NUM_FAILS
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Feed sahap a gzipped WIF and make sure it parses to the same matrix as the plain file.
+USAGE=' '
+REG_DIR=${REG_DIR:?"needs to be set"}
+TMPDIR=`mktemp -d /tmp/sahap-gzip.XXXXXX`
+trap "/bin/rm -rf $TMPDIR; exit" 0 1 2 3 15
+
+NUM_FAILS=0
+WIF=data/500SNPs_30x/Model_14.wif
+
+gzip -c $WIF > $TMPDIR/reads.wif.gz
+./sahap.MEC $TMPDIR/reads.wif.gz data/500SNPs_30x/Model_14.txt 1 > $REG_DIR/gzip.out 2>&1
+if fgrep -q 'Parsed 150 reads over 486 sites' $REG_DIR/gzip.out && fgrep -q '(100.0' $REG_DIR/gzip.out; then
+    echo "gzip input: OK"
+else
+    echo "gzip input: FAIL"; (( ++NUM_FAILS ))
+fi
+
+# A cut-off archive must be reported, not silently parsed as shorter input
+head -c 2000 $TMPDIR/reads.wif.gz > $TMPDIR/truncated.wif.gz
+if ./sahap.MEC $TMPDIR/truncated.wif.gz 2>&1 | fgrep -q 'Truncated gzip input'; then
+    echo "truncated gzip input: OK"
+else
+    echo "truncated gzip input: FAIL"; (( ++NUM_FAILS ))
+fi
+exit $NUM_FAILS
@@ -0,0 +1,14 @@
+#!/bin/bash
+# Anneal several restarts in one process and check the combined result is no worse than the best restart.
+USAGE=' '
+REG_DIR=${REG_DIR:?"needs to be set"}
+
+NUM_FAILS=0
+./sahap.MEC --restarts 4 data/500SNPs_30x/Model_14.wif data/500SNPs_30x/Model_14.txt 1 > $REG_DIR/restarts.out 2>&1
+if fgrep 'Restart costs:' $REG_DIR/restarts.out | awk '{exit(NF < 10 || $10 > $4)}' &&
+    fgrep '(100.0' $REG_DIR/restarts.out | awk '{for(i=1;i<NF;i++)if($i=="Err_Pct")err=$(i+1)+0} END{exit(err=="" || err > 2)}'; then
+    echo "restarts: OK"
+else
+    echo "restarts: FAIL"; (( ++NUM_FAILS ))
+fi
+exit $NUM_FAILS
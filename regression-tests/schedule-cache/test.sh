@@ -0,0 +1,37 @@
+#!/bin/bash
+# The second run on the same input must reuse the schedule the first one calibrated, and so
+# must a different input of nearly the same shape.
+USAGE=' '
+REG_DIR=${REG_DIR:?"needs to be set"}
+TMPDIR=`mktemp -d /tmp/sahap-schedule.XXXXXX`
+trap "/bin/rm -rf $TMPDIR; exit" 0 1 2 3 15
+
+NUM_FAILS=0
+RUN="./sahap.MEC --schedule-cache $TMPDIR/schedules"
+ARGS="data/500SNPs_30x/Model_14.wif data/500SNPs_30x/Model_14.txt 1"
+
+$RUN $ARGS > $REG_DIR/schedule1.out 2>&1
+$RUN $ARGS > $REG_DIR/schedule2.out 2>&1
+if fgrep -q 'tInitial =' $REG_DIR/schedule1.out && fgrep -q 'Using cached schedule' $REG_DIR/schedule2.out &&
+    ! fgrep -q 'tInitial =' $REG_DIR/schedule2.out && fgrep -q '(100.0' $REG_DIR/schedule2.out; then
+    echo "cached schedule: OK"
+else
+    echo "cached schedule: FAIL"; (( ++NUM_FAILS ))
+fi
+
+$RUN --recalibrate $ARGS > $REG_DIR/schedule3.out 2>&1
+if fgrep -q 'tInitial =' $REG_DIR/schedule3.out && [ `wc -l < $TMPDIR/schedules` -eq 2 ]; then
+    echo "recalibrate: OK"
+else
+    echo "recalibrate: FAIL"; (( ++NUM_FAILS ))
+fi
+# One read fewer: other counts, but coverage, read length and sites in the same buckets
+sed '127d' data/500SNPs_30x/Model_14.wif > $TMPDIR/similar.wif
+$RUN $TMPDIR/similar.wif 1 > $REG_DIR/schedule4.out 2>&1
+if fgrep -q 'Using cached schedule' $REG_DIR/schedule4.out && ! fgrep -q 'tInitial =' $REG_DIR/schedule4.out &&
+    [ `wc -l < $TMPDIR/schedules` -eq 2 ]; then
+    echo "similar input: OK"
+else
+    echo "similar input: FAIL"; (( ++NUM_FAILS ))
+fi
+exit $NUM_FAILS
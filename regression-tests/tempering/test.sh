@@ -0,0 +1,14 @@
+#!/bin/bash
+# Phase with parallel tempering instead of a single cooling chain and check it is about as good.
+USAGE=' '
+REG_DIR=${REG_DIR:?"needs to be set"}
+
+NUM_FAILS=0
+./sahap.MEC --replicas 8 data/500SNPs_30x/Model_14.wif data/500SNPs_30x/Model_14.txt 1 > $REG_DIR/tempering.out 2>&1
+if fgrep -q 'Parallel tempering with 8 replicas' $REG_DIR/tempering.out &&
+    fgrep '(100.0' $REG_DIR/tempering.out | awk '{for(i=1;i<NF;i++)if($i=="Err_Pct")err=$(i+1)+0} END{exit(err=="" || err > 2)}'; then
+    echo "parallel tempering: OK"
+else
+    echo "parallel tempering: FAIL"; (( ++NUM_FAILS ))
+fi
+exit $NUM_FAILS
@@ -0,0 +1,169 @@
+#include "BinaryInput.hpp"
+#include "MappedFile.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#define SAHAP_BINARY_MAGIC "SAHAPRM"
+#define SAHAP_BYTE_ORDER 0x01020304
+
+namespace SAHap {
+
+constexpr uint32_t BinaryInputReader::VERSION;
+
+namespace {
+
+inline size_t padded(size_t bytes) {
+	return (bytes + 7) & ~(size_t)7;
+}
+
+// FNV-style hash taken a 64-bit word at a time; sections are zero-padded to whole words
+class Checksum {
+public:
+	void update(const void * data, size_t bytes) {
+		const char * p = (const char *)data;
+		size_t words = bytes / 8;
+		for (size_t i = 0; i < words; ++i) {
+			uint64_t w;
+			memcpy(&w, p + 8 * i, 8);
+			this->add(w);
+		}
+		if (bytes % 8) {
+			uint64_t w = 0;
+			memcpy(&w, p + 8 * words, bytes % 8);
+			this->add(w);
+		}
+	}
+
+	uint64_t value() const { return this->h; }
+
+private:
+	uint64_t h = 14695981039346656037ULL;
+
+	void add(uint64_t w) {
+		this->h = (this->h ^ w) * 1099511628211ULL;
+	}
+};
+
+class SectionWriter {
+public:
+	SectionWriter(FILE * fp) : fp(fp) {}
+
+	void write(const void * data, size_t bytes) {
+		static const char zeros[8] = {0};
+		if (fwrite(data, 1, bytes, this->fp) != bytes || fwrite(zeros, 1, padded(bytes) - bytes, this->fp) != padded(bytes) - bytes) {
+			throw "Error writing binary read-matrix file";
+		}
+		this->sum.update(data, bytes);
+	}
+
+	uint64_t checksum() const { return this->sum.value(); }
+
+private:
+	FILE * fp;
+	Checksum sum;
+};
+
+}
+
+bool BinaryInputReader::isBinary(const string& path) {
+	if (path == "-") return false;
+	char magic[sizeof(SAHAP_BINARY_MAGIC)] = {0};
+	FILE * fp = fopen(path.c_str(), "rb");
+	if (!fp) return false;
+	bool binary = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, SAHAP_BINARY_MAGIC, sizeof(magic)) == 0;
+	fclose(fp);
+	return binary;
+}
+
+InputFile BinaryInputReader::read(const string& path) {
+	auto start = chrono::steady_clock::now();
+	shared_ptr<MappedFile> file = make_shared<MappedFile>(path, false);
+	const char * data = file->data();
+
+	Header h;
+	if (file->size() < sizeof(Header)) throw "Truncated binary read-matrix file";
+	memcpy(&h, data, sizeof(Header));
+	if (memcmp(h.magic, SAHAP_BINARY_MAGIC, sizeof(SAHAP_BINARY_MAGIC)) != 0) throw "Not a binary read-matrix file";
+	if (h.version != VERSION) throw "Unsupported binary read-matrix version; re-run sahap convert";
+	if (h.byteOrder != SAHAP_BYTE_ORDER) throw "Binary read-matrix file was written on a machine with another byte order";
+
+	size_t sizes[] = {
+		h.numSites * sizeof(uint64_t),
+		(h.numReads + 1) * sizeof(uint64_t),
+		h.numReads * sizeof(uint32_t),
+		h.numReads * sizeof(uint32_t),
+		h.numEntries * sizeof(uint32_t),
+		h.numEntries * sizeof(uint8_t),
+		h.numEntries * sizeof(uint8_t),
+	};
+	const char * sections[7];
+	size_t offset = sizeof(Header);
+	for (int i = 0; i < 7; ++i) {
+		sections[i] = data + offset;
+		offset += padded(sizes[i]);
+	}
+	if (offset != file->size()) throw "Truncated binary read-matrix file";
+
+	Checksum sum;
+	sum.update(data + sizeof(Header), file->size() - sizeof(Header));
+	if (sum.value() != h.checksum) throw "Binary read-matrix file is corrupt (checksum mismatch)";
+
+	InputFile result;
+	result.ploidy = h.ploidy;
+	result.averageReadLength = h.averageReadLength;
+	const uint64_t * sites = (const uint64_t *)sections[0];
+	result.sites.assign(sites, sites + h.numSites);
+
+	ReadStore::Arrays arrays;
+	arrays.numReads = h.numReads;
+	arrays.numEntries = h.numEntries;
+	arrays.offsets = (const uint64_t *)sections[1];
+	arrays.starts = (const uint32_t *)sections[2];
+	arrays.ends = (const uint32_t *)sections[3];
+	arrays.pos = (const uint32_t *)sections[4];
+	arrays.allele = (const uint8_t *)sections[5];
+	arrays.weight = (const uint8_t *)sections[6];
+	result.reads = ReadStore(arrays, file);
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("Mapped %lu reads over %lu sites from %s in %.3fs\n",
+		(unsigned long)result.reads.size(), (unsigned long)result.sites.size(), path.c_str(), seconds);
+	return result;
+}
+
+void BinaryInputReader::write(const InputFile& input, const string& path) {
+	FILE * fp = fopen(path.c_str(), "wb");
+	if (!fp) throw "Cannot open binary read-matrix file for writing";
+
+	const ReadStore::Arrays& a = input.reads.arrays();
+	Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SAHAP_BINARY_MAGIC, sizeof(SAHAP_BINARY_MAGIC));
+	h.version = VERSION;
+	h.byteOrder = SAHAP_BYTE_ORDER;
+	h.ploidy = input.ploidy;
+	h.numSites = input.sites.size();
+	h.numReads = a.numReads;
+	h.numEntries = a.numEntries;
+	h.averageReadLength = input.averageReadLength;
+
+	// Write a placeholder header, then the sections, then the real header with the checksum
+	fwrite(&h, sizeof(h), 1, fp);
+	SectionWriter out(fp);
+	vector<uint64_t> sites(input.sites.begin(), input.sites.end());
+	out.write(sites.data(), sites.size() * sizeof(uint64_t));
+	out.write(a.offsets, (a.numReads + 1) * sizeof(uint64_t));
+	out.write(a.starts, a.numReads * sizeof(uint32_t));
+	out.write(a.ends, a.numReads * sizeof(uint32_t));
+	out.write(a.pos, a.numEntries * sizeof(uint32_t));
+	out.write(a.allele, a.numEntries * sizeof(uint8_t));
+	out.write(a.weight, a.numEntries * sizeof(uint8_t));
+
+	h.checksum = out.checksum();
+	if (fseek(fp, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, fp) != 1 || fclose(fp) != 0) {
+		throw "Error writing binary read-matrix file";
+	}
+}
+
+}
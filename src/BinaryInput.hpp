@@ -0,0 +1,62 @@
+#ifndef SAHAP_BINARYINPUT_HPP
+#define SAHAP_BINARYINPUT_HPP
+
+#include <string>
+#include "InputReader.hpp"
+
+using namespace std;
+
+namespace SAHap {
+
+/*
+ * Binary read-matrix files hold a parsed InputFile, so repeated runs on the
+ * same data can map it instead of parsing WIF text again. The file is mapped
+ * shared and read-only: concurrent runs on one machine share its pages.
+ *
+ * Layout, in native byte order, every section padded to 8 bytes:
+ *   Header
+ *   sites    uint64 x numSites      genome position of each matrix position
+ *   offsets  uint64 x numReads + 1  CSR row offsets
+ *   starts   uint32 x numReads
+ *   ends     uint32 x numReads
+ *   pos      uint32 x numEntries    matrix position of each read site
+ *   allele   uint8  x numEntries
+ *   weight   uint8  x numEntries
+ */
+class BinaryInputReader {
+public:
+	static constexpr uint32_t VERSION = 1;
+
+	/**
+	 * Returns true if the file at path starts like a binary read-matrix file
+	 */
+	static bool isBinary(const string& path);
+
+	/**
+	 * Maps a binary read-matrix file, checking its version and checksum
+	 */
+	static InputFile read(const string& path);
+
+	/**
+	 * Saves a parsed input as a binary read-matrix file
+	 */
+	static void write(const InputFile& input, const string& path);
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder; // 0x01020304 as written by the producing machine
+		uint32_t ploidy;
+		uint32_t reserved;
+		uint64_t numSites;
+		uint64_t numReads;
+		uint64_t numEntries;
+		uint64_t averageReadLength;
+		uint64_t checksum; // of everything after the header
+	};
+};
+
+}
+
+#endif
@@ -5,24 +5,64 @@
 #include <unistd.h>
 
 #include <iostream>
+#include <atomic>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <string>
+#include <thread>
 
 #define SAHAP_GENOME_DEBUG 0
+// Define to 1 to check every deltaCost() against actually making the move
+#ifndef SAHAP_CHECK_DELTA
+#define SAHAP_CHECK_DELTA 0
+#endif
 
-enum _objectives        { OBJ_NONE,   OBJ_MEC,   OBJ_Poisson };
-const char *objName[] = {"OBJ_NONE",     "MEC",     "Poisson"};
-#ifndef OBJECTIVE
-#define OBJECTIVE OBJ_MEC // choices for now are MEC and Poisson
+// With setRejectionFree(), optimize() draws accepted moves directly while fAccept is below
+// this, and goes back to plain Metropolis once it is above twice this
+#ifndef REJECTION_FREE_THRESHOLD
+#define REJECTION_FREE_THRESHOLD 0.02
 #endif
-#if (OBJECTIVE != OBJ_MEC && OBJECTIVE != OBJ_Poisson)
-#error "invalid objective"
+// It keeps the move rates of one temperature until the temperature has moved this far from it
+#ifndef REJECTION_FREE_DRIFT
+#define REJECTION_FREE_DRIFT 0.01
 #endif
 
 #define TARGET_PBAD_START 0.85
 #define TARGET_PBAD_END 1e-3
+// autoSchedule() solves for its temperatures from this many sampled moves, then checks them
+// with findPbad() for up to this many rounds
+#define CALIBRATION_SAMPLES 20000
+#ifndef CALIBRATION_ROUNDS
+#define CALIBRATION_ROUNDS 3
+#endif
+// A window needs this many uphill moves to set its own schedule
+#define WINDOW_CALIBRATION_MIN 20
+// A window is done early once its MEC is at the target with pBad below CONVERGED_PBAD, or once
+// its cost has not improved for the convergence horizon with fAccept below CONVERGED_FACCEPT
+#define CONVERGED_PBAD 0.01
+#define CONVERGED_FACCEPT 0.02
+// DynamicSchedule() starts a window over when its MEC is this far above the target near the end
+#define FULL_RETREAT_FACTOR 1.3
+// The Lam schedule may change the temperature by LAM_GAIN times the window's whole range over
+// the window. A window whose MEC is too high, and that has not improved for LAM_PATIENCE of it,
+// is reheated from the best state seen, by LAM_REHEAT of the range per multiple of the target
+// its MEC is at.
+#define LAM_GAIN 10
+// It steers by the mean pBad of about the last LAM_MEMORY uphill moves
+#define LAM_MEMORY 100
+#define LAM_PATIENCE 0.1
+#define LAM_REHEAT 0.25
+// optimize() keeps the moves accepted since the lowest cost of the window, to go back to it
+// when the window ends; past UNDO_LOG_LIMIT moves per window read it notes that state instead.
+// Costs closer than BEST_COST_EPSILON (relative) count as equal.
+#define UNDO_LOG_LIMIT 4
+#define BEST_COST_EPSILON 1e-9
 // How is the temperature schedule adjusted to be dynamic?
 enum _schedule            { SCHED_NONE,   SCHED_RETREAT,   SCHED_Betz };
 const char *schedName[] = {"SCHED_NONE",       "RETREAT",       "Betz"};
@@ -40,17 +80,108 @@ using namespace std;
 
 namespace SAHap {
 
+namespace {
+
+// Runs job(0) .. job(count - 1) on up to `threads` threads, the calling one included;
+// whatever the first failed job threw is thrown again once they all finished
+void runParallel(size_t count, unsigned threads, const function<void(size_t)>& job) {
+	vector<exception_ptr> errors(count);
+	atomic<size_t> next(0);
+	auto work = [&]() {
+		for (size_t i; (i = next++) < count; ) {
+			try {
+				job(i);
+			} catch (...) {
+				errors[i] = current_exception();
+			}
+		}
+	};
+	vector<thread> pool;
+	for (unsigned i = 1; i < min((size_t)threads, count); ++i) pool.push_back(thread(work));
+	work();
+	for (auto& worker : pool) worker.join();
+	for (auto& e : errors) {
+		if (e) rethrow_exception(e);
+	}
+}
+
+// pBad at temperature t for proposals with the given uphill deltas
+double pbadAt(const vector<double>& deltas, double t) {
+	double sum = 0;
+	for (double d : deltas) sum += exp(-d / t);
+	return sum / deltas.size();
+}
+
+// What acceptance() gives a move of cost change delta at temperature t
+double acceptanceAt(double delta, double t) {
+	if (delta < 0) return 1;
+	if (t == 0) return 0;
+	return exp(-delta / t);
+}
 
-Genome::Genome(InputFile file)
+// The temperature at which pbadAt() is target; pBad only grows with t.
+// A guess close to the answer saves most of the search.
+double solvePbad(const vector<double>& deltas, double target, double guess = 0) {
+	double lo, hi;
+	if (guess > 0) {
+		lo = hi = log(guess);
+		while (pbadAt(deltas, exp(lo)) > target) lo -= 1;
+		while (pbadAt(deltas, exp(hi)) < target) hi += 1;
+	} else {
+		lo = log(*min_element(deltas.begin(), deltas.end())) - 10;
+		hi = log(*max_element(deltas.begin(), deltas.end())) + 10;
+	}
+	while (hi - lo > 1e-6) {
+		double mid = (lo + hi) / 2;
+		if (pbadAt(deltas, exp(mid)) < target) lo = mid; else hi = mid;
+	}
+	return exp(hi);
+}
+
+// The target pBad at fraction s of the schedule: down from TARGET_PBAD_START to TARGET_PBAD_END
+// at a constant rate. (Lam & Delosme's curve, held at 0.44 for half the run, is meant for all
+// moves, and it keeps a window hot for so long here that it loses its phase.)
+double lamTarget(double s) {
+	return TARGET_PBAD_START * pow(TARGET_PBAD_END / TARGET_PBAD_START, min(s, 1.0));
+}
+
+}
+
+// Runs CALL(Model, P) for the scoring model and ploidy in use, so the annealing
+// loop is compiled once per combination; P = 0 is the generic-ploidy fallback.
+#define SAHAP_DISPATCH_PLOIDY(CALL, Model) \
+	switch (this->haplotypes.size()) { \
+	case 2: CALL(Model, 2); break; \
+	case 3: CALL(Model, 3); break; \
+	case 4: CALL(Model, 4); break; \
+	case 6: CALL(Model, 6); break; \
+	default: CALL(Model, 0); break; \
+	}
+#define SAHAP_DISPATCH(CALL) \
+	switch (this->model->kind()) { \
+	case ScoringModel::MEC: SAHAP_DISPATCH_PLOIDY(CALL, MECModel); break; \
+	case ScoringModel::POISSON: SAHAP_DISPATCH_PLOIDY(CALL, PoissonModel); break; \
+	case ScoringModel::WMEC: SAHAP_DISPATCH_PLOIDY(CALL, WMECModel); break; \
+	}
+
+
+Genome::Genome(InputFile file, const ScoringModel& model)
+	: Genome(file, model, GetFancySeed(true))
+{
+	cout << "Genome seed " << (long)this->seed << endl;
+}
+
+Genome::Genome(InputFile file, const ScoringModel& model, unsigned long seed)
+	: matrix(file.sites.size(), file.ploidy), model(&model), seed(seed)
 {
-	long int seed = GetFancySeed(true);
-	cout << "Genome seed " << seed << endl;
 	this->randomEngine = mt19937(seed);
 	this->file = file;
-	this->haplotypes = vector<Haplotype>(this->file.ploidy, Haplotype(this->file.index.size(), file.ploidy));
+	for (unsigned i = 0; i < this->file.ploidy; ++i) {
+		this->haplotypes.push_back(Haplotype(&this->matrix, i, model.usesSiteCost(), model.usesWeights()));
+	}
 	this->range.start = 0;
-	this->range.end = this->file.index.size();
-	this->numberOfSites = this->file.index.size();
+	this->range.end = this->file.sites.size();
+	this->numberOfSites = this->file.sites.size();
 	this->increments = file.averageReadLength;
 	this->shuffle();
 }
@@ -110,24 +241,11 @@ double Genome::windowTotalCoverage() {
 //Returns: (probably) max cost of the all sites in haplotype
 //CHECKME: only score calculating function that is being called
 double Genome::windowMec() {
-	double out = 0;
-
-	for (size_t i = 0; i < haplotypes.size(); i++) {
-		// -logT_p(lambda_i, k_i)
-#if OBJECTIVE == OBJ_MEC
-		out = out + haplotypes[i].windowMec();
-#elif OBJECTIVE == OBJ_Poisson
-		out = out + haplotypes[i].siteCost(); // siteCost() should probably be renamed to PoissonWindowMec
-#else
-#error "No objective chosen"
-#endif
-
-	}
-
-	// cout << "siteCost: " << out << endl;
+	return this->model->windowCost(this->haplotypes);
+}
 
-	// double maxCost = this->haplotypes.size() * this->haplotypes[0].size();
-	return out;// / maxCost;
+const ScoringModel& Genome::scoringModel() const {
+	return *this->model;
 }
 
 
@@ -153,16 +271,27 @@ void Genome::shuffle() {
 
 	if (this->initialized) {
 		auto ploidy = this->haplotypes.size();
-		auto length = this->haplotypes[0].size();
+		this->matrix.reset();
 		this->haplotypes.clear();
-		this->haplotypes = vector<Haplotype>(ploidy, Haplotype(length, ploidy));
+		for (unsigned i = 0; i < ploidy; ++i) {
+			this->haplotypes.push_back(Haplotype(&this->matrix, i, this->model->usesSiteCost(), this->model->usesWeights()));
+		}
 	}
 
-	for (auto& r : this->file.reads) {
-		this->haplotypes[distribution(this->randomEngine)].add(&r);
+	this->assignment.assign(this->file.reads.size(), 0);
+	this->windowReads.clear();
+	this->pendingReads.clear();
+	for (dnacnt_t id = 0; id < this->file.reads.size(); ++id) {
+		size_t h = this->isPinned(id) ? this->pinned[id] : distribution(this->randomEngine);
+		this->assignment[id] = h;
+		this->haplotypes[h].add(this->file.reads[id]);
+		// Until a window is set up, every read is fair game
+		if (!this->isPinned(id))
+			this->windowReads.push_back(id);
 	}
 
 	this->initialized = true;
+	this->deltasValid = false;
 
 	// for (auto& ch : this->haplotypes) {
 	// 	cout << ch << endl;
@@ -197,80 +326,216 @@ void Genome::setParameters(double tInitial, double tEnd, iteration_t maxIteratio
 	this->tDecay = -log(tEnd / this->tInitial);
 	this->maxIterations = maxIterations;
 
-	cout << "decay is " << this->tDecay << endl;
+	if (this->verbose) cout << "decay is " << this->tDecay << endl;
 }
 
 void Genome::setTemperature(double t) {
 	this->t = t;
 }
 
+void Genome::move() {
+#define CALL(Model, P) this->move<P>()
+	SAHAP_DISPATCH_PLOIDY(CALL, _);
+#undef CALL
+}
+
+template <unsigned P>
 void Genome::move() {
 	// Perform a random move, saving enough information so we can revert later
+	this->applyMove<P>(this->pickMove<P>());
+}
 
-	auto ploidy = this->haplotypes.size();
-	size_t moveFrom = rand() % ploidy;
-	size_t moveTo;
-	// FIXME1: why are we picking the source haplotype FIRST when it's possible there's no
-	// reads in it? This while() loop checks for this condition and keeps looping until it finds a haplotype
-	// with reads in it... but it's probably better to pick a READ from the entire universe first, the FIND
-	// it's haploptype, then choose ANOTHER haplotype to move it to.
-	// In any case the current code *should* work... but it's ugly.
-	// It's also bad in a WINDOWING system because if the read we pick is one we shouldn't touch, we have to
-	// come back all the way to here to start again... which means TWO nested while loops. Very bad.
-	// FIXME1: so, pick the read FIRST.
-	unsigned numTries = 0;
-	while (!this->haplotypes[moveFrom].numReads()) { // chose moveFrom (keep choosing until we find a non-empty haplotype)
-		if (ploidy == 2) {
-			moveFrom = !moveFrom;
-		} else {
-			moveFrom = rand() % ploidy;
-		}
-		assert(numTries++ < 10*ploidy); // this should be MORE than enough to NEVER iterate forever
+template <unsigned P>
+Genome::Move Genome::pickMove() {
+	Move m;
+	if (this->windowReads.empty()) {
+		m.from = m.to = 0;
+		m.read = 0;
+		return m;
 	}
+
+	// Pick the read first, uniformly over the window, then the haplotype it lives on
+	size_t ploidy = P ? P : this->haplotypes.size();
+	uniform_int_distribution<size_t> pickRead(0, this->windowReads.size() - 1);
+	Read r = this->file.reads[this->windowReads[pickRead(this->randomEngine)]];
+	size_t moveFrom = this->assignment[r.id];
+	size_t moveTo;
+
 	// now choose where to move *to* (someplace other than from)
-	if (ploidy == 2) {
+	if (P == 2) {
 		moveTo = !moveFrom;
 	} else {
-		size_t moveOffset = rand() % (ploidy - 1);
-		moveTo = (moveFrom + moveOffset + 1) % ploidy;
+		uniform_int_distribution<size_t> pickOffset(1, ploidy - 1);
+		moveTo = (moveFrom + pickOffset(this->randomEngine)) % ploidy;
 	}
 	assert(moveFrom != moveTo);
-	// Move this "pick the read" up above FIXME1, but choose among the entire universe of reads, not just those on
-	// "moveFrom". Instead, pick the read, then set moveFrom to it's current haplotype, then choose moveTo as above.
-	Read * r = this->haplotypes[moveFrom].randomRead(this->randomEngine);
-	// HERE is where you put your code to check if this read shouldn't be touched because it has substantial
-	// overlap with the previous window. (And you can make that decision even before looking at it's haplotype.
 
 #if SAHAP_GENOME_DEBUG
-	printf("move read %p from %d to %d\n", r, moveFrom, moveTo);
-	if (!r) {
-		cerr << "DEBUG: Haplotype " << moveFrom << " has no reads remaining" << endl;
-		std::raise(SIGINT);
-		r = this->haplotypes[moveFrom].randomRead(this->randomEngine);
-	}
+	printf("move read %lu from %d to %d\n", (unsigned long)r.id, (int)moveFrom, (int)moveTo);
 #endif
 
-	// std::cout << "From: " << moveFrom << ", To: " << moveTo << std::endl;
+	m.from = moveFrom;
+	m.to = moveTo;
+	m.read = r.id;
+	return m;
+}
+
+template <unsigned P>
+void Genome::applyMove(const Move& m) {
+	this->lastMove = m;
+	if (m.from == m.to) return;
+
+	assert(this->assignment[m.read] == m.from);
+	Read r = this->file.reads[m.read];
+	this->haplotypes[m.to].add<P>(r);
+	this->haplotypes[m.from].remove<P>(r);
+	this->assignment[m.read] = m.to;
+}
+
+double Genome::deltaCost(dnacnt_t read, size_t from, size_t to) {
+	double delta = 0;
+#define CALL(Model, P) delta = this->deltaCostWith<Model, P>(read, from, to)
+	SAHAP_DISPATCH(CALL);
+#undef CALL
+	return delta;
+}
 
-	this->haplotypes[moveTo].add(r);
-	this->haplotypes[moveFrom].remove(r);
+template <class Model, unsigned P>
+double Genome::deltaCostWith(dnacnt_t read, size_t from, size_t to) const {
+	if (from == to) return 0;
+	Read r = this->file.reads[read];
+	double windowMecDelta = 0, siteCostDelta = 0;
+	// Different haplotypes have separate counts, so the two halves of the move don't interact
+	this->haplotypes[from].voteDelta<P>(r, true, windowMecDelta, siteCostDelta);
+	this->haplotypes[to].voteDelta<P>(r, false, windowMecDelta, siteCostDelta);
+	return Model::delta(windowMecDelta, siteCostDelta);
+}
 
-	this->lastMove.from = moveFrom;
-	this->lastMove.to = moveTo;
-	this->lastMove.read = r;
+void Genome::revertMove() {
+#define CALL(Model, P) this->revertMove<P>()
+	SAHAP_DISPATCH_PLOIDY(CALL, _);
+#undef CALL
 }
 
+template <unsigned P>
 void Genome::revertMove() {
 	const auto& move = this->lastMove;
-	this->haplotypes[move.to].remove(move.read);
-	this->haplotypes[move.from].add(move.read);
+	if (move.from == move.to) return;
+	assert(this->assignment[move.read] == move.to);
+	Read r = this->file.reads[move.read];
+	this->haplotypes[move.to].remove<P>(r);
+	this->haplotypes[move.from].add<P>(r);
+	this->assignment[move.read] = move.from;
+}
+
+void Genome::pin(dnacnt_t id, size_t haplotype) {
+	assert(haplotype < this->haplotypes.size());
+	if (this->pinned.empty()) {
+		this->pinned.assign(this->file.reads.size(), -1);
+	}
+	this->pinned[id] = haplotype;
+
+	// Move it there now, so the current state respects the pin
+	this->moveRead(id, haplotype);
+	this->windowReads.erase(remove(this->windowReads.begin(), this->windowReads.end(), id), this->windowReads.end());
+	this->deltasValid = false;
+	this->pendingReads.erase(remove(this->pendingReads.begin(), this->pendingReads.end(), id), this->pendingReads.end());
+}
+
+void Genome::moveRead(dnacnt_t id, size_t to) {
+	size_t from = this->assignment[id];
+	if (from == to) return;
+	Read r = this->file.reads[id];
+	this->haplotypes[to].add(r);
+	this->haplotypes[from].remove(r);
+	this->assignment[id] = to;
+}
+
+bool Genome::isPinned(dnacnt_t id) const {
+	return !this->pinned.empty() && this->pinned[id] >= 0;
+}
+
+size_t Genome::haplotypeOf(dnacnt_t id) const {
+	return this->assignment[id];
+}
+
+const vector<Range>& Genome::phasedBlocks() const {
+	return this->blocks;
+}
+
+void Genome::initializeWindow(unsigned windowSize) {
+	this->range.start = 0;
+	this->range.end = min((dnapos_t)windowSize, this->numberOfSites);
+
+	for (auto& haplotype : this->haplotypes) {
+		haplotype.initializeWindow(windowSize, this->increments);
+	}
+
+	this->windowReads.clear();
+	this->pendingReads.clear();
+	for (dnacnt_t id = 0; id < this->file.reads.size(); ++id) {
+		if (!this->isPinned(id))
+			this->pendingReads.push_back(id);
+	}
+	this->pickReads(0);
+}
+
+void Genome::incrementWindow() {
+	dnapos_t oldEnd = this->range.end;
+
+	this->range.start += this->increments;
+	this->range.end = min(this->range.end + this->increments, this->numberOfSites);
+
+	for (auto& haplotype : this->haplotypes) {
+		haplotype.incrementWindow();
+	}
+
+	// Reads from the last window that reach into the new one go back to the pending pool
+	for (auto id : this->windowReads) {
+		if (this->file.reads[id].range.end > this->range.start)
+			this->pendingReads.push_back(id);
+	}
+	this->pickReads(oldEnd - this->range.start);
+}
+
+// Moves pending reads that extend past the first `overlap` sites of the window into windowReads.
+// Reads that end before the window starts can never be picked again, so they are dropped.
+void Genome::pickReads(dnapos_t overlap) {
+	this->windowReads.clear();
+	this->deltasValid = false;
+
+	size_t kept = 0;
+	for (auto id : this->pendingReads) {
+		Range rr = this->file.reads[id].range;
+		if (rr.end > this->range.start + overlap && rr.start <= this->range.end) {
+			this->windowReads.push_back(id);
+		} else if (rr.end > this->range.start) {
+			this->pendingReads[kept++] = id;
+		}
+	}
+	this->pendingReads.resize(kept);
 }
 
 void Genome::iteration() {
-	auto oldScore = this->windowMec();
-	// FIXME: these lines recomputes ALL the sites?? It should only incrementally compute the old and new scores at the sites touched by this read! Inefficient!
-	this->move();
-	auto newScore = this->windowMec();
+#define CALL(Model, P) this->iterationWith<Model, P>()
+	SAHAP_DISPATCH(CALL);
+#undef CALL
+}
+
+template <class Model, unsigned P>
+void Genome::iterationWith() {
+	// Score the move from the current counts; the haplotypes only change if it is accepted
+	Move m = this->pickMove<P>();
+	double oldScore = Model::cost(this->haplotypes);
+	double delta = this->deltaCostWith<Model, P>(m.read, m.from, m.to);
+	double newScore = oldScore + delta;
+
+#if SAHAP_CHECK_DELTA
+	this->applyMove<P>(m);
+	double actual = Model::cost(this->haplotypes) - oldScore;
+	this->revertMove<P>();
+	assert(fabs(actual - delta) <= 1e-9 * max(1.0, fabs(actual)));
+#endif
 
 	uniform_real_distribution<double> distribution(0, 1);
 	double chanceToKeep = this->acceptance(newScore, oldScore);
@@ -280,11 +545,9 @@ void Genome::iteration() {
 	bool accept = randomIndex <= chanceToKeep;
 	assert(!isGood || accept);
 
-	if (isGood) {
-		// always accept
-	} else if (!accept) {
-		// reject
-		this->revertMove();
+	if (accept) {
+		this->applyMove<P>(m);
+		if (this->trackBest) this->logMove(m, newScore);
 	}
 
 	this->fAccept.record(isGood);
@@ -307,14 +570,252 @@ void Genome::iteration() {
 #endif
 }
 
+void Genome::setRejectionFree(bool enabled) {
+	this->rejectionFree = enabled;
+}
+
+// One step of the n-fold way (Bortz, Kalos & Lebowitz): instead of proposing moves until one is
+// accepted, draw how many proposals would have been rejected, then draw the accepted move with
+// probability proportional to its acceptance. Returns the iterations that took, at most limit;
+// if the accepted move would come later than that, nothing moves.
+template <class Model, unsigned P>
+iteration_t Genome::rejectionFreeStep(iteration_t limit) {
+	size_t ploidy = P ? P : this->haplotypes.size();
+	size_t others = ploidy - 1;
+	if (!this->deltasValid) this->initMoveDeltas<Model, P>();
+	if (this->rateTemperature < 0 || fabs(this->t - this->rateTemperature) > REJECTION_FREE_DRIFT * this->rateTemperature)
+		this->refreshMoveRates();
+
+	// Proposals are uniform over reads and then destinations, as in pickMove()
+	double total = this->moveRate.total();
+	double rejected = this->moveDelta.size() - total, rejectedRate = total - this->rateSquares;
+	double pAccept = this->moveDelta.empty() ? 0 : total / this->moveDelta.size();
+
+	uniform_real_distribution<double> distribution(0, 1);
+	iteration_t skipped = limit;
+	if (pAccept >= 1) {
+		skipped = 0;
+	} else if (pAccept > 0) {
+		double draw = floor(log(1 - distribution(this->randomEngine)) / log1p(-pAccept));
+		if (draw < limit) skipped = draw;
+	}
+
+	// The skipped proposals were all uphill and all rejected; record their mean acceptance
+	if (skipped > 0) {
+		double pRejected = rejected > 0 ? min(max(rejectedRate / rejected, 0.0), 1.0) : 0;
+		for (iteration_t i = 0; i < min(skipped, (iteration_t)this->fAccept.LENGTH); ++i) {
+			this->fAccept.record(false);
+			this->pBad.record(pRejected);
+		}
+		this->totalBad += skipped;
+	}
+	if (skipped == limit) return limit;
+
+	size_t pick = this->moveRate.find(distribution(this->randomEngine) * total);
+
+	Move m;
+	m.read = this->windowReads[pick / others];
+	m.from = this->assignment[m.read];
+	m.to = (m.from + 1 + pick % others) % ploidy;
+	double delta = this->moveDelta[pick];
+	double rate = this->moveRate[pick];
+#if SAHAP_CHECK_DELTA
+	double actual = this->deltaCostWith<Model, P>(m.read, m.from, m.to);
+	assert(fabs(actual - delta) <= 1e-9 * max(1.0, fabs(actual)));
+#endif
+	this->applyMove<P>(m);
+	this->updateMoveDeltas<Model, P>(this->file.reads[m.read].range);
+	if (this->trackBest) this->logMove(m, Model::cost(this->haplotypes));
+
+	this->fAccept.record(delta < 0);
+	if (delta > 0) {
+		this->totalBad++;
+		this->totalBadAccepted++;
+		this->pBad.record(rate);
+	}
+	return skipped + 1;
+}
+
+// Computes every move delta of the window, and orders the window reads by start
+template <class Model, unsigned P>
+void Genome::initMoveDeltas() {
+	size_t ploidy = P ? P : this->haplotypes.size();
+	size_t n = this->windowReads.size();
+	const ReadStore& reads = this->file.reads;
+	this->moveDelta.resize(n * (ploidy - 1));
+	this->byStart.resize(n);
+	iota(this->byStart.begin(), this->byStart.end(), 0);
+	sort(this->byStart.begin(), this->byStart.end(), [this, &reads](size_t a, size_t b) {
+		return reads[this->windowReads[a]].range.start < reads[this->windowReads[b]].range.start;
+	});
+	this->windowSpan = 0;
+	for (size_t k = 0; k < n; ++k) {
+		Range r = reads[this->windowReads[k]].range;
+		this->windowSpan = max(this->windowSpan, r.end - r.start);
+	}
+
+	this->rateTemperature = -1; // refreshMoveRates() rebuilds the rates as well
+	for (size_t k = 0; k < n; ++k) this->updateMoveDeltas<Model, P>(k);
+	this->deltasValid = true;
+}
+
+// Recomputes the move deltas, and rates if set, of the window reads that share sites with
+// touched: those starting between windowSpan before it and its end
+template <class Model, unsigned P>
+void Genome::updateMoveDeltas(Range touched) {
+	const ReadStore& reads = this->file.reads;
+	dnapos_t from = touched.start > this->windowSpan ? touched.start - this->windowSpan : 0;
+	auto first = lower_bound(this->byStart.begin(), this->byStart.end(), from, [this, &reads](size_t k, dnapos_t pos) {
+		return reads[this->windowReads[k]].range.start < pos;
+	});
+	for (auto it = first; it != this->byStart.end(); ++it) {
+		Range r = reads[this->windowReads[*it]].range;
+		if (r.start > touched.end) break;
+		if (this->intersects(r, touched)) this->updateMoveDeltas<Model, P>(*it);
+	}
+}
+
+template <class Model, unsigned P>
+void Genome::updateMoveDeltas(size_t k) {
+	size_t ploidy = P ? P : this->haplotypes.size();
+	size_t others = ploidy - 1;
+	dnacnt_t id = this->windowReads[k];
+	size_t from = this->assignment[id];
+	for (size_t j = 0; j < others; ++j) {
+		size_t i = k * others + j;
+		this->moveDelta[i] = this->deltaCostWith<Model, P>(id, from, (from + 1 + j) % ploidy);
+		if (this->rateTemperature < 0) continue;
+		double rate = acceptanceAt(this->moveDelta[i], this->rateTemperature);
+		this->rateSquares += rate * rate - this->moveRate[i] * this->moveRate[i];
+		this->moveRate.set(i, rate);
+	}
+}
+
+// Recomputes every move rate at the current temperature
+void Genome::refreshMoveRates() {
+	vector<double> rates(this->moveDelta.size());
+	this->rateSquares = 0;
+	for (size_t i = 0; i < rates.size(); ++i) {
+		rates[i] = acceptanceAt(this->moveDelta[i], this->t);
+		this->rateSquares += rates[i] * rates[i];
+	}
+	this->moveRate.assign(rates);
+	this->rateTemperature = this->t;
+}
+
+// Solves for the current window's own start temperature from the cost change of every move it
+// allows, as autoSchedule() does for the whole input; the previous window's is the starting
+// guess, and stays if the window has too few uphill moves to go by. The end temperature stays
+// the calibrated one: the window has not been annealed yet, and its uphill moves now are far
+// smaller than the ones it will meet once it is cold, so solving for it here ends windows hot.
+template <class Model, unsigned P>
+void Genome::calibrateWindowWith() {
+	size_t ploidy = P ? P : this->haplotypes.size();
+	vector<double> deltas;
+	for (dnacnt_t id : this->windowReads) {
+		size_t from = this->assignment[id];
+		for (size_t j = 1; j < ploidy; ++j) {
+			double delta = this->deltaCostWith<Model, P>(id, from, (from + j) % ploidy);
+			if (delta > 0) deltas.push_back(delta);
+		}
+	}
+	if (deltas.size() < WINDOW_CALIBRATION_MIN) return;
+
+	double tEnd = this->finalTemperature();
+	double tInitial = solvePbad(deltas, TARGET_PBAD_START, this->windowTInitial);
+	if (tInitial <= tEnd) return;
+	this->windowTInitial = tInitial;
+	this->windowTDecay = log(tInitial / tEnd);
+}
+
 double Genome::getTemperature(iteration_t iteration) {
 	double s = iteration / (double)this->maxIterations;
-	double temp = (double)this->tInitial * exp(-this->tDecay * s);
+	double temp = (double)this->windowTInitial * exp(-this->windowTDecay * s);
 
 	// cout << iteration << ": " << temp << endl;
 	return temp;
 }
 
+void Genome::FeedbackSchedule(iteration_t iterations) {
+	// The pBad buffer averages over too many moves to steer by; fold every entry recorded since
+	// the last call into a running average instead. A rejection-free step counts more uphill
+	// proposals than the buffer holds, all with the same pBad as its oldest entry.
+	if (this->totalBad < this->lamSeen) this->lamSeen = this->totalBad;
+	if (this->totalBad > this->lamSeen) {
+		const double keep = 1 - 1.0 / LAM_MEMORY;
+		size_t fresh = this->totalBad - this->lamSeen;
+		size_t held = min(fresh, this->pBad.len);
+		size_t i = (this->pBad.pos + PbadBuffer::LENGTH + 1 - held) % PbadBuffer::LENGTH;
+		if (fresh > held && held > 0) {
+			double oldest = this->pBad.buffer[i];
+			this->pBadRecent = oldest + (this->pBadRecent - oldest) * pow(keep, (double)(fresh - held));
+		}
+		for (size_t k = 0; k < held; ++k, i = (i + 1) % PbadBuffer::LENGTH) {
+			this->pBadRecent += (this->pBad.buffer[i] - this->pBadRecent) / LAM_MEMORY;
+		}
+		this->lamSeen = this->totalBad;
+	}
+	double step = pow(this->lamStep, (double)iterations);
+	if (this->pBadRecent > lamTarget(fracTime()))
+		this->t /= step;
+	else
+		this->t = min(this->t * step, this->windowTInitial);
+}
+
+void Genome::startWindowSchedule() {
+	this->t = this->windowTInitial;
+	this->lamStep = exp(LAM_GAIN * this->windowTDecay / this->maxIterations);
+	this->pBadRecent = lamTarget(0);
+}
+
+void Genome::resetBest(double cost) {
+	this->bestSeenCost = cost;
+	this->undoLog.clear();
+	this->bestWindow.clear();
+}
+
+void Genome::logMove(const Move& m, double cost) {
+	if (m.from == m.to) return;
+	if (cost < this->bestSeenCost - BEST_COST_EPSILON * max(1.0, fabs(this->bestSeenCost))) {
+		this->resetBest(cost);
+		return;
+	}
+	if (!this->bestWindow.empty()) return;
+
+	this->undoLog.push_back(m);
+	if (this->undoLog.size() > UNDO_LOG_LIMIT * this->windowReads.size()) {
+		// Long past the best state: note where its window reads were instead, by undoing the
+		// log on the assignment alone, and stop logging until the next best
+		for (auto it = this->undoLog.rbegin(); it != this->undoLog.rend(); ++it) this->assignment[it->read] = it->from;
+		this->bestWindow.resize(this->windowReads.size());
+		for (size_t k = 0; k < this->windowReads.size(); ++k) this->bestWindow[k] = this->assignment[this->windowReads[k]];
+		for (const Move& logged : this->undoLog) this->assignment[logged.read] = logged.to;
+		this->undoLog.clear();
+	}
+}
+
+void Genome::restoreBest() {
+	if (!this->bestWindow.empty()) {
+		for (size_t k = 0; k < this->windowReads.size(); ++k) this->moveRead(this->windowReads[k], this->bestWindow[k]);
+	} else {
+		for (auto it = this->undoLog.rbegin(); it != this->undoLog.rend(); ++it) this->moveRead(it->read, it->from);
+	}
+	assert(fabs(this->windowMec() - this->bestSeenCost) <= 1e-6 * max(1.0, fabs(this->bestSeenCost)));
+	this->undoLog.clear();
+	this->bestWindow.clear();
+	this->deltasValid = false;
+}
+
+Genome::Schedule Genome::scheduleByName(const string& name) {
+	if (name == "retreat") return RETREAT;
+	if (name == "lam") return LAM;
+	throw "Unknown schedule; expected retreat or lam";
+}
+
+void Genome::setSchedule(Schedule schedule) {
+	this->schedule = schedule;
+}
+
 double Genome::fracTime() {
     return this->curIteration*1.0/this->maxIterations;
 }
@@ -329,20 +830,239 @@ void Genome::ResetBuffers() {
     this->totalBadAccepted = this->totalGood = 0;
 }
 
+void Genome::setThreads(unsigned threads) {
+	this->threads = threads;
+}
+
 void Genome::optimize(bool debug) {
+	unsigned threads = this->threads ? this->threads : max(1u, thread::hardware_concurrency());
+	if (threads > 1) {
+		// A few jobs per thread, so one slow job doesn't hold up the rest
+		auto jobs = this->componentJobs(4 * threads);
+		if (jobs.size() > 1) {
+			this->optimizeComponents(jobs, threads, debug);
+			return;
+		}
+	}
+
+	if (this->restarts > 1) {
+		this->optimizeRestarts(threads, debug);
+		return;
+	}
+
+	if (this->replicas > 1) {
+#define CALL(Model, P) this->temperWith<Model, P>(threads, debug)
+		SAHAP_DISPATCH(CALL);
+#undef CALL
+		return;
+	}
+
+#define CALL(Model, P) this->optimizeWith<Model, P>(debug)
+	SAHAP_DISPATCH(CALL);
+#undef CALL
+}
+
+void Genome::setReplicas(unsigned replicas) {
+	this->replicas = max(1u, replicas);
+}
+
+void Genome::setWindowSchedules(bool enabled) {
+	this->windowSchedules = enabled;
+}
+
+void Genome::setConvergenceHorizon(iteration_t iterations) {
+	this->convergenceHorizon = iterations;
+}
+
+void Genome::setRestarts(unsigned restarts) {
+	this->restarts = max(1u, restarts);
+}
+
+void Genome::copySettings(const Genome& from) {
+	this->tInitial = from.tInitial;
+	this->tDecay = from.tDecay;
+	this->maxIterations = from.maxIterations;
+	this->rejectionFree = from.rejectionFree;
+	this->windowSchedules = from.windowSchedules;
+	this->convergenceHorizon = from.convergenceHorizon;
+	this->schedule = from.schedule;
+	this->replicas = from.replicas;
+	this->restarts = from.restarts;
+	this->threads = 1;
+}
+
+void Genome::optimizeRestarts(unsigned threads, bool debug) {
+	auto start_time = duration_cast<seconds>(system_clock::now().time_since_epoch());
+	size_t n = this->restarts;
+	if (debug) {
+		printf("Annealing %lu restarts on %u threads using %s cost function\n",
+		    n, min(threads, (unsigned)n), this->model->name());
+	}
+
+	vector<unique_ptr<Genome>> runs;
+	for (size_t k = 0; k < n; ++k) {
+		runs.emplace_back(new Genome(this->sharedInput(), *this->model, this->randomEngine()));
+		runs.back()->copySettings(*this);
+		runs.back()->restarts = 1;
+		for (dnacnt_t id = 0; id < this->assignment.size(); ++id) {
+			if (this->isPinned(id)) runs.back()->pin(id, this->pinned[id]);
+		}
+	}
+	runParallel(n, threads, [&](size_t k) { runs[k]->optimize(false); });
+
+	// Blocks share no sites, so the cheapest run of each block can be combined freely
+	const vector<Range>& blocks = runs[0]->phasedBlocks();
+	vector<size_t> winner(blocks.size(), 0);
+	vector<size_t> wins(n, 0);
+	for (size_t b = 0; b < blocks.size(); ++b) {
+		double cheapest = INFINITY;
+		for (size_t k = 0; k < n; ++k) {
+			double cost = this->model->rangeCost(runs[k]->haplotypes, blocks[b]);
+			if (cost < cheapest) {
+				cheapest = cost;
+				winner[b] = k;
+			}
+		}
+		wins[winner[b]]++;
+	}
+	size_t b = 0;
+	for (dnacnt_t id = 0; id < this->assignment.size(); ++id) {
+		while (this->file.reads[id].range.start > blocks[b].end) b++;
+		this->moveRead(id, runs[winner[b]]->assignment[id]);
+	}
+
+	if (debug) {
+		vector<double> costs;
+		for (size_t k = 0; k < n; ++k) {
+			costs.push_back(this->model->rangeCost(runs[k]->haplotypes, Range(0, this->numberOfSites)));
+			printf("Restart %lu: %s %.2f, best in %lu of %lu blocks\n", k, this->model->name(), costs[k], wins[k], blocks.size());
+		}
+		sort(costs.begin(), costs.end());
+		printf("Restart costs: best %.2f  median %.2f  worst %.2f  combined %.2f\n", costs.front(), costs[n / 2],
+		    costs.back(), this->model->rangeCost(this->haplotypes, Range(0, this->numberOfSites)));
+	}
+
+	auto now_time = duration_cast<seconds>(system_clock::now().time_since_epoch());
+	this->finishMerged((int)(now_time - start_time).count(), debug);
+}
+
+InputFile Genome::sharedInput() const {
+	InputFile out;
+	out.ploidy = this->file.ploidy;
+	out.sites = this->file.sites;
+	out.reads = this->file.reads; // shares the arrays
+	out.averageReadLength = this->file.averageReadLength;
+	return out;
+}
+
+// Parallel tempering: every replica anneals the same window at its own fixed temperature,
+// and after every SWAP_INTERVAL iterations neighbouring temperatures trade replicas with
+// the Metropolis rule. At the end of a window all replicas take on the best window any of
+// them had at a swap, so they share their history when the window moves on.
+#define SWAP_INTERVAL REPORT_INTERVAL
+template <class Model, unsigned P>
+void Genome::temperWith(unsigned threads, bool debug) {
+	auto start_time = duration_cast<seconds>(system_clock::now().time_since_epoch());
+	size_t n = this->replicas;
+
+	// Spaced geometrically from the end of the calibrated schedule (coldest, ladder[0]) to its start
+	vector<double> ladder(n);
+	double tEnd = this->finalTemperature();
+	for (size_t k = 0; k < n; ++k) {
+		ladder[k] = tEnd * pow(this->tInitial / tEnd, k / (double)(n - 1));
+	}
+	if (debug) {
+		printf("Parallel tempering with %lu replicas from T %.3f to %.3f on %u threads, optimizing %s\n",
+		    n, ladder[0], ladder[n - 1], min(threads, (unsigned)n), this->model->name());
+	}
+
+	vector<unique_ptr<Genome>> reps;
+	for (size_t k = 0; k < n; ++k) {
+		reps.emplace_back(new Genome(this->sharedInput(), *this->model, this->randomEngine()));
+		for (dnacnt_t id = 0; id < this->assignment.size(); ++id) {
+			if (this->isPinned(id)) reps.back()->pin(id, this->pinned[id]);
+		}
+	}
+	// at[k] = the replica currently at temperature ladder[k]
+	vector<size_t> at(n);
+	for (size_t k = 0; k < n; ++k) at[k] = k;
+
+	unsigned WINDOW_SIZE = increments * 2;
+	for (auto& r : reps) r->initializeWindow(WINDOW_SIZE);
+
+	uniform_real_distribution<double> distribution(0, 1);
+	iteration_t swapsTried = 0, swapsMade = 0;
+	vector<double> cost(n);
+	while (true) {
+		// The lowest-cost window seen by any replica at a swap point
+		const vector<dnacnt_t>& reads = reps[0]->windowReads; // the same in every replica
+		double bestCost = INFINITY, bestT = 0;
+		vector<size_t> bestPlace(reads.size());
+
+		for (iteration_t done = 0; done < this->maxIterations; done += SWAP_INTERVAL) {
+			iteration_t steps = min((iteration_t)SWAP_INTERVAL, this->maxIterations - done);
+			runParallel(n, threads, [&](size_t k) {
+				Genome& g = *reps[at[k]];
+				g.t = ladder[k];
+				for (iteration_t i = 0; i < steps; ++i) g.iterationWith<Model, P>();
+				cost[k] = Model::cost(g.haplotypes);
+			});
+
+			for (size_t k = 0; k < n; ++k) {
+				if (cost[k] >= bestCost) continue;
+				bestCost = cost[k];
+				bestT = ladder[k];
+				for (size_t i = 0; i < reads.size(); ++i) bestPlace[i] = reps[at[k]]->assignment[reads[i]];
+			}
+
+			for (size_t k = 0; k + 1 < n; ++k) {
+				swapsTried++;
+				if (distribution(this->randomEngine) < exp((cost[k] - cost[k + 1]) * (1 / ladder[k] - 1 / ladder[k + 1]))) {
+					swap(at[k], at[k + 1]);
+					swap(cost[k], cost[k + 1]);
+					swapsMade++;
+				}
+			}
+		}
+
+		for (auto& r : reps) {
+			for (size_t i = 0; i < reads.size(); ++i) r->moveRead(reads[i], bestPlace[i]);
+		}
+
+		Range window = reps[0]->range;
+		if (debug) {
+			printf("Window %lu->%lu  best MEC %.2f at T %.3f  swaps %.1f%%\n", window.start, window.end,
+			    reps[0]->windowMEC(), bestT, swapsTried ? 100.0 * swapsMade / swapsTried : 0.0);
+		}
+		if (window.start + WINDOW_SIZE >= this->numberOfSites)
+			break;
+		for (auto& r : reps) r->incrementWindow();
+	}
+
+	for (dnacnt_t id = 0; id < this->assignment.size(); ++id) this->moveRead(id, reps[0]->assignment[id]);
+
+	auto now_time = duration_cast<seconds>(system_clock::now().time_since_epoch());
+	this->finishMerged((int)(now_time - start_time).count(), debug);
+}
+
+template <class Model, unsigned P>
+void Genome::optimizeWith(bool debug) {
 	// unsigned int TARGET_MEC = 0;//this->haplotypes[0].size() * this->totalCoverage() * READ_ERROR_RATE;
 	// Reset state
 	this->t = this->tInitial;
+	this->windowTInitial = this->tInitial;
+	this->windowTDecay = this->tDecay;
+	this->verbose = debug;
+	this->trackBest = true;
 	ResetBuffers();
 
 	unsigned WINDOW_SIZE = increments * 2;
 	double ERROR = READ_ERROR_RATE;
 	double add = 0.0001; // FIXME: WTF is this?
-	range.end = WINDOW_SIZE;
-	
-	for (auto& haplotype : this->haplotypes) {
-		haplotype.initializeWindow(WINDOW_SIZE, increments);
-	}
+	this->initializeWindow(WINDOW_SIZE);
+	if (this->windowSchedules) this->calibrateWindowWith<Model, P>();
+	this->startWindowSchedule();
+	this->resetBest(Model::cost(this->haplotypes));
 
 	// Target MEC for the Window
 	double PTARGET_MEC = windowTotalCoverage() * ERROR;
@@ -350,40 +1070,101 @@ void Genome::optimize(bool debug) {
 	auto start_time = duration_cast<seconds>(system_clock::now().time_since_epoch());
 	// assert(this->haplotypes.size() == 2); // FIXME need to change a few things below that assume only 0 and 1 exist.
 	assert(this->haplotypes[0].size() == this->haplotypes[1].size());
-	printf("Performing %ld meta-iterations of %d each using schedule %s,\n",
-	    (long)(this->maxIterations/META_ITER), META_ITER, schedName[SCHEDULE]);
-	printf("optimizing objective %s across %lu sites with total coverage %g, target MEC %g\n",
-	    objName[OBJECTIVE], this->haplotypes[0].size(), this->meanCoverage(), PTARGET_MEC);
+	if (debug) {
+		printf("Performing %ld meta-iterations of %d each using schedule %s,\n",
+		    (long)(this->maxIterations/META_ITER), META_ITER, this->schedule == LAM ? "Lam" : schedName[SCHEDULE]);
+		printf("optimizing objective %s across %lu sites with total coverage %g, target MEC %g\n",
+		    this->model->name(), this->haplotypes[0].size(), this->meanCoverage(), PTARGET_MEC);
+	}
 
 	
 	int cpuSeconds = 0;
 	int tmp = 0;
+	this->rejectionFreeActive = false;
+	// The window's lowest cost so far, and when it was reached
+	double bestCost = numeric_limits<double>::infinity();
+	iteration_t improvedAt = 0;
+	unsigned windows = 1, windowsConverged = 0, retreats = 0, reheats = 0;
+	iteration_t saved = 0, annealed = 0;
 	
-	while (range.start + WINDOW_SIZE <= numberOfSites) {
-		this->t = this->getTemperature(this->curIteration);
-		this->iteration();
-		this->curIteration++;
+	while (true) {
+		iteration_t from = this->curIteration;
+		if (this->schedule == RETREAT) this->t = this->getTemperature(this->curIteration);
+		if (this->rejectionFree) {
+			double fA = this->fAccept.getAverage();
+			this->rejectionFreeActive = fA < (this->rejectionFreeActive ? 2 : 1) * REJECTION_FREE_THRESHOLD;
+		}
+		if (this->rejectionFreeActive) {
+			// Stop at the next iteration DynamicSchedule() and Report() look at
+			iteration_t limit = REPORT_INTERVAL/2 - this->curIteration % (REPORT_INTERVAL/2);
+			limit = min(limit, this->maxIterations - this->curIteration);
+			this->curIteration += this->rejectionFreeStep<Model, P>(max(limit, (iteration_t)1));
+		} else {
+			this->iterationWith<Model, P>();
+			this->curIteration++;
+			this->deltasValid = false;
+		}
+		annealed += this->curIteration - from;
+		if (this->schedule == LAM) FeedbackSchedule(this->curIteration - from);
 		double pBad = this->pBad.getAverage();
 		iteration_t prev = curIteration;
-		DynamicSchedule(pBad, PTARGET_MEC);
-		if (debug && curIteration % REPORT_INTERVAL == 0) {
+		if (this->schedule == RETREAT) DynamicSchedule(pBad, PTARGET_MEC);
+		if (prev > curIteration) {
+			// Retreated; the window has to settle again
+			bestCost = numeric_limits<double>::infinity();
+			improvedAt = curIteration;
+			retreats++;
+		} else if (curIteration % (REPORT_INTERVAL/2) == 0 && !this->done()) {
+			double cost = Model::cost(this->haplotypes);
+			if (cost < bestCost) {
+				bestCost = cost;
+				improvedAt = curIteration;
+			}
+			double factor = windowMEC() / PTARGET_MEC;
+			if (this->schedule == LAM && factor > FULL_RETREAT_FACTOR && curIteration - improvedAt >= LAM_PATIENCE * this->maxIterations) {
+				// Stuck in a bad state: go back to the best one and warm up again, no more than
+				// can be cooled off again in half the iterations left
+				this->restoreBest();
+				double reheat = min(LAM_REHEAT * factor, LAM_GAIN * (1 - fracTime()) / 2);
+				this->t = min(this->t * exp(reheat * this->windowTDecay), this->windowTInitial);
+				improvedAt = curIteration;
+				reheats++;
+				if (this->verbose) cout << "Reheat at " << 100 * fracTime() << "% to T " << this->t << " because MEC is " << windowMEC()
+				    << ", too big by a factor of " << factor << endl;
+			}
+			bool reached = factor <= 1 && pBad < CONVERGED_PBAD;
+			bool stalled = factor <= FULL_RETREAT_FACTOR && curIteration - improvedAt >= this->convergenceHorizon &&
+			    this->fAccept.getAverage() < CONVERGED_FACCEPT;
+			if (this->convergenceHorizon && (reached || stalled)) {
+				saved += this->maxIterations - curIteration;
+				windowsConverged++;
+				curIteration = this->maxIterations;
+			}
+		}
+		if (curIteration % REPORT_INTERVAL == 0) {
 			auto now_time = duration_cast<seconds>(system_clock::now().time_since_epoch());
 			cpuSeconds = (int)(now_time - start_time).count();
-			Report(cpuSeconds);
+			if (debug) Report(cpuSeconds);
 			// if(fracTime() > 0.5 && pBad < 0.01 && mec() <= TARGET_MEC) {
 			//     printf("Exiting early because MEC %lu reached target\n", mec());
 			//     this->curIteration = this->maxIterations; // basically done
 			// }
 		}
 		if (this->done()){//} || (pmec() <= PTARGET_MEC)){
-			range.start += increments;
-			range.end += increments;
+			this->restoreBest();
+			// The window that reaches the last site is the last one
+			if (range.start + WINDOW_SIZE >= numberOfSites)
+				break;
 			curIteration = 0;
 			tmp = cpuSeconds;
-			
-			for (auto& haplotype : haplotypes) {
-				haplotype.incrementWindow();
-			}
+			bestCost = numeric_limits<double>::infinity();
+			improvedAt = 0;
+			windows++;
+
+			this->incrementWindow();
+			if (this->windowSchedules) this->calibrateWindowWith<Model, P>();
+			this->startWindowSchedule();
+			this->resetBest(Model::cost(this->haplotypes));
 
 			add = 0;
 			PTARGET_MEC = windowTotalCoverage() * ERROR;
@@ -392,13 +1173,24 @@ void Genome::optimize(bool debug) {
 			PTARGET_MEC = windowTotalCoverage() * (ERROR + add);
 		}
 
-		if (cpuSeconds  > tmp + 50){ // For Debugging to break out if program can't find optimal solution
+		// Quiet runs (component jobs, restarts, replicas, stream segments) keep time too, but
+		// must anneal every window
+		if (debug && cpuSeconds  > tmp + 50){ // For Debugging to break out if program can't find optimal solution
 			break;
 		}
 	}
-	Report(cpuSeconds, true);
-	printf("Finished optimizing %d sites using %s cost function\n", (int)this->haplotypes[0].size(), objName[OBJECTIVE]);
-	cout << "MEC: " << mec() << endl;
+	this->restoreBest();
+	if (debug) {
+		Report(cpuSeconds, true);
+		printf("Annealed %llu iterations over %u windows, with %u retreats and %u reheats\n", annealed, windows, retreats, reheats);
+		if (this->convergenceHorizon) {
+			printf("%u of %u windows converged early, saving %llu iterations (%.1f%%)\n", windowsConverged, windows,
+			    saved, 100.0 * saved / ((double)windows * this->maxIterations));
+		}
+		printf("Finished optimizing %d sites using %s cost function\n", (int)this->haplotypes[0].size(), this->model->name());
+		cout << "MEC: " << mec() << endl;
+	}
+	this->trackBest = false;
 
 	// for (auto h : haplotypes) {
 	// 	// h.printCoverages();
@@ -407,8 +1199,145 @@ void Genome::optimize(bool debug) {
 	createBlocks();
 }
 
+vector<vector<dnacnt_t>> Genome::components() const {
+	// Union-find over sites; each read joins all of its sites into one set
+	vector<dnapos_t> parent(this->numberOfSites);
+	for (dnapos_t s = 0; s < this->numberOfSites; ++s) parent[s] = s;
+	auto find = [&parent](dnapos_t s) {
+		while (parent[s] != s) {
+			parent[s] = parent[parent[s]];
+			s = parent[s];
+		}
+		return s;
+	};
+
+	for (dnacnt_t id = 0; id < this->file.reads.size(); ++id) {
+		Read r = this->file.reads[id];
+		dnapos_t root = find(r.pos[0]);
+		for (Site site : r) {
+			dnapos_t other = find(site.pos);
+			if (other != root) parent[other] = root;
+		}
+	}
+
+	vector<vector<dnacnt_t>> out;
+	vector<long> index(this->numberOfSites, -1);
+	for (dnacnt_t id = 0; id < this->file.reads.size(); ++id) {
+		dnapos_t root = find(this->file.reads[id].pos[0]);
+		if (index[root] < 0) {
+			index[root] = out.size();
+			out.emplace_back();
+		}
+		out[index[root]].push_back(id);
+	}
+	return out;
+}
+
+vector<vector<dnacnt_t>> Genome::componentJobs(size_t maxJobs) const {
+	auto parts = this->components();
+	if (parts.size() <= 1) return parts;
+
+	// Annealing time follows the number of read entries, so balance on that
+	size_t target = this->file.reads.numSites() / maxJobs + 1;
+	vector<vector<dnacnt_t>> jobs(1);
+	size_t entries = 0;
+	for (auto& part : parts) {
+		if (entries >= target) {
+			jobs.emplace_back();
+			entries = 0;
+		}
+		for (dnacnt_t id : part) entries += this->file.reads[id].size();
+		jobs.back().insert(jobs.back().end(), part.begin(), part.end());
+	}
+	for (auto& job : jobs) sort(job.begin(), job.end());
+	return jobs;
+}
+
+InputFile Genome::slice(const vector<dnacnt_t>& reads) const {
+	InputFile out;
+	out.ploidy = this->file.ploidy;
+	for (dnacnt_t id : reads) {
+		Read r = this->file.reads[id];
+		vector<Site> sites;
+		for (Site s : r) sites.push_back(s);
+		out.reads.push_back(sites, r.range);
+	}
+
+	// Renumber our matrix positions from 0; ids don't move since reads stay in order of their start
+	vector<dnapos_t> used = out.reads.distinctPositions();
+	out.reads.compress(used);
+	for (dnapos_t pos : used) out.sites.push_back(this->file.sites[pos]);
+	WIFInputReader::finish(out);
+	return out;
+}
+
+// How many windows optimize() anneals over the sites, sliding a window of twice increments by increments
+iteration_t windowsOver(dnapos_t sites, dnacnt_t increments) {
+	dnapos_t size = 2 * increments;
+	if (sites <= size || increments == 0) return 1;
+	return 1 + (sites - size + increments - 1) / increments;
+}
+
+// Every job anneals its share of the sites with its share of the iterations a single sweep over
+// all of them would take, spread over its own windows; so many small components don't add up to
+// more annealing than the whole input gets with one thread. A window still gets at least
+// REPORT_INTERVAL iterations and at most as many as in the single sweep.
+void Genome::optimizeComponents(const vector<vector<dnacnt_t>>& jobs, unsigned threads, bool debug) {
+	auto start_time = duration_cast<seconds>(system_clock::now().time_since_epoch());
+	if (debug) {
+		printf("Optimizing %lu groups of independent reads on %u threads using %s cost function\n",
+		    jobs.size(), threads, this->model->name());
+	}
+
+	// Every job gets its own random stream, drawn up front so the result doesn't depend on timing
+	vector<unsigned long> seeds;
+	for (size_t i = 0; i < jobs.size(); ++i) seeds.push_back(this->randomEngine());
+
+	// Largest jobs first
+	vector<size_t> order(jobs.size());
+	for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+	sort(order.begin(), order.end(), [&jobs](size_t a, size_t b) { return jobs[a].size() > jobs[b].size(); });
+
+	vector<vector<size_t>> results(jobs.size());
+	runParallel(jobs.size(), threads, [&](size_t n) {
+		size_t i = order[n];
+		Genome part(this->slice(jobs[i]), *this->model, seeds[i]);
+		part.copySettings(*this);
+		double share = part.numberOfSites / (double)this->numberOfSites;
+		double budget = share * windowsOver(this->numberOfSites, this->increments) * this->maxIterations;
+		part.maxIterations = min(this->maxIterations,
+		    max((iteration_t)REPORT_INTERVAL, (iteration_t)(budget / windowsOver(part.numberOfSites, part.increments))));
+		for (dnacnt_t k = 0; k < jobs[i].size(); ++k) {
+			if (this->isPinned(jobs[i][k])) part.pin(k, this->pinned[jobs[i][k]]);
+		}
+		part.optimize(false);
+		for (dnacnt_t k = 0; k < jobs[i].size(); ++k) results[i].push_back(part.haplotypeOf(k));
+	});
+
+	// Move every read to where its job left it
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		for (dnacnt_t k = 0; k < jobs[i].size(); ++k) this->moveRead(jobs[i][k], results[i][k]);
+	}
+
+	auto now_time = duration_cast<seconds>(system_clock::now().time_since_epoch());
+	this->finishMerged((int)(now_time - start_time).count(), debug);
+}
+
+void Genome::finishMerged(int cpuSeconds, bool debug) {
+	this->initializeWindow(this->numberOfSites);
+	this->curIteration = this->maxIterations;
+	this->t = this->finalTemperature();
+	if (debug) {
+		Report(cpuSeconds, true);
+		printf("Finished optimizing %d sites using %s cost function\n", (int)this->haplotypes[0].size(), this->model->name());
+		cout << "MEC: " << mec() << endl;
+	}
+	createBlocks();
+}
+
 void Genome::createBlocks() {
-	for (Read r : file.reads) {
+	for (dnacnt_t id = 0; id < file.reads.size(); ++id) {
+		Read r = file.reads[id];
 		if (blocks.empty() || !intersects(blocks.back(), r.range))
 			blocks.push_back(r.range);
 		else
@@ -450,6 +1379,15 @@ void Genome::Report(int cpuSeconds, bool final) {
 }
 
 double Genome::findPbad(double temperature, iteration_t iterations) {
+	double pBad = 0;
+#define CALL(Model, P) pBad = this->findPbadWith<Model, P>(temperature, iterations)
+	SAHAP_DISPATCH(CALL);
+#undef CALL
+	return pBad;
+}
+
+template <class Model, unsigned P>
+double Genome::findPbadWith(double temperature, iteration_t iterations) {
 	this->shuffle();
 
 	this->t = temperature;
@@ -458,7 +1396,7 @@ double Genome::findPbad(double temperature, iteration_t iterations) {
 	double sumPbad = 0.0, prevSumPbad;
 	int i = 0;
 	do {
-		this->iteration();
+		this->iterationWith<Model, P>();
 		// cout << "[simann] temp=" << this->t << ", mec=" << this->mec() << endl;
 		double newPbad = this->pBad.getAverage();
 		prevSumPbad = sumPbad;
@@ -467,26 +1405,100 @@ double Genome::findPbad(double temperature, iteration_t iterations) {
 		// below, we compute the previous and current average and demand they agree to some precision
 	} while (i < 30 || fabs(prevSumPbad/(i-1) / (sumPbad/i) - 1) > 1e-3); // stabilize to at least this relative precision
 
-	cout << "temperature " << temperature << " gives Pbad " << this->pBad.getAverage() << " after " << i << " iterations\n";
+	if (this->verbose) {
+		cout << "temperature " << temperature << " gives Pbad " << this->pBad.getAverage() << " after " << i << " iterations\n";
+	}
 
 	return this->pBad.getAverage();
 }
 
+// Cost changes of random moves from a random state, keeping only the uphill ones,
+// which are the moves pBad averages over
+template <class Model, unsigned P>
+vector<double> Genome::uphillDeltasWith(size_t samples) {
+	this->shuffle();
+	vector<double> out;
+	for (size_t i = 0; i < samples; ++i) {
+		Move m = this->pickMove<P>();
+		if (m.from == m.to) break;
+		double delta = this->deltaCostWith<Model, P>(m.read, m.from, m.to);
+		if (delta > 0) out.push_back(delta);
+	}
+	return out;
+}
+
+vector<double> Genome::findPbads(const vector<double>& temperatures) {
+	unsigned threads = this->threads ? this->threads : max(1u, thread::hardware_concurrency());
+	vector<unsigned long> seeds;
+	for (size_t i = 0; i < temperatures.size(); ++i) seeds.push_back(this->randomEngine());
+
+	vector<double> out(temperatures.size());
+	runParallel(temperatures.size(), threads, [&](size_t i) {
+		Genome probe(this->sharedInput(), *this->model, seeds[i]);
+		for (dnacnt_t id = 0; id < this->assignment.size(); ++id) {
+			if (this->isPinned(id)) probe.pin(id, this->pinned[id]);
+		}
+		probe.verbose = false;
+		out[i] = probe.findPbad(temperatures[i]);
+	});
+	for (size_t i = 0; i < temperatures.size(); ++i) {
+		cout << "temperature " << temperatures[i] << " gives Pbad " << out[i] << endl;
+	}
+	return out;
+}
+
+// Solves for the temperatures giving TARGET_PBAD_START and TARGET_PBAD_END from a sample of
+// uphill deltas, then checks them with findPbad(). A temperature that misses is rescaled by how
+// far the measured pBad is off on the sampled curve, and checked again; we keep the best one
+// measured, so what we return has always been checked.
 void Genome::autoSchedule(iteration_t iterations) {
 	cout << "Finding optimal temperature schedule..." << endl;
 
-	double tInitial = 1;
-	while (this->findPbad(tInitial) < TARGET_PBAD_START) tInitial *= 2;
-	while (this->findPbad(tInitial) > TARGET_PBAD_START) tInitial /= 2;
-	while (this->findPbad(tInitial) < TARGET_PBAD_START) tInitial *= 1.2;
-	cout << "tInitial found: " << tInitial << endl;
-	double tEnd = tInitial;
-	while (this->findPbad(tEnd) > TARGET_PBAD_END) tEnd /= 2;
-	while (this->findPbad(tEnd) < TARGET_PBAD_END) tEnd *= 1.2;
+	vector<double> deltas;
+#define CALL(Model, P) deltas = this->uphillDeltasWith<Model, P>(CALIBRATION_SAMPLES)
+	SAHAP_DISPATCH(CALL);
+#undef CALL
+	if (deltas.empty()) {
+		// Nothing can get worse, so any temperature will do
+		cout << "No move increases the cost; using a nominal schedule" << endl;
+		this->setParameters(1, TARGET_PBAD_END, iterations);
+		return;
+	}
 
-	cout << "tInitial = " << tInitial << ", tEnd = " << tEnd << endl;
+	vector<double> targets = {TARGET_PBAD_START, TARGET_PBAD_END};
+	vector<double> solved = {solvePbad(deltas, targets[0]), solvePbad(deltas, targets[1])};
+	vector<double> temps = solved, best = solved, bestMiss = {HUGE_VAL, HUGE_VAL};
+	cout << "sampled " << deltas.size() << " uphill moves: tInitial " << temps[0] << ", tEnd " << temps[1] << endl;
+
+	vector<size_t> check = {0, 1};
+	for (int round = 0; round < CALIBRATION_ROUNDS && !check.empty(); ++round) {
+		vector<double> probes;
+		for (size_t i : check) probes.push_back(temps[i]);
+		vector<double> measured = this->findPbads(probes);
+
+		vector<size_t> again;
+		for (size_t j = 0; j < check.size(); ++j) {
+			size_t i = check[j];
+			double p = measured[j];
+			// The probe at the end temperature descends, meeting larger deltas than the random
+			// sample; a lower pBad is expected there, so it only has to be cold enough
+			bool close = i == 0 ? fabs(p - targets[0]) <= 0.05 * targets[0] : p <= 10 * targets[1];
+			double miss = close ? 0 : p > 0 && p < 1 ? fabs(log(p / targets[i])) : HUGE_VAL;
+			if (miss < bestMiss[i]) {
+				best[i] = temps[i];
+				bestMiss[i] = miss;
+			}
+			if (close || p <= 0 || p >= 1 || round == CALIBRATION_ROUNDS - 1) continue;
+			// The sample put pBad p at solvePbad(deltas, p) where we measured it at temps[i], so
+			// the target is where the sample puts it, scaled by the same ratio
+			temps[i] *= solved[i] / solvePbad(deltas, p);
+			again.push_back(i);
+		}
+		check = again;
+	}
 
-	this->setParameters(tInitial, tEnd, iterations);
+	cout << "tInitial = " << best[0] << ", tEnd = " << best[1] << endl;
+	this->setParameters(best[0], best[1], iterations);
 }
 
 void Genome::PbadBuffer::record(double acceptance) {
@@ -560,7 +1572,7 @@ dnacnt_t Genome::compareGroundTruth() {
 dnacnt_t Genome::compareGroundTruth(const Haplotype& ch, const vector<int>& truth) {
 	dnacnt_t loss = 0;
 	for (size_t i = 0; i < ch.size(); ++i) {
-		if (ch.solution[i] != truth[i]) {
+		if (ch.solutionAt(i) != truth[i]) {
 			loss++;
 		}
 	}
@@ -574,10 +1586,10 @@ ostream& operator << (ostream& stream, const Genome& ge) {
 		for (size_t i = 0; i < ge.haplotypes.size(); ++i) {
 			for (size_t j = 0; j < ge.haplotypes[i].size(); ++j) {
 				if (j >= r.start && j <= r.end) {
-					if (ge.haplotypes[i].solution[j] < 0)
+					if (ge.haplotypes[i].solutionAt(j) < 0)
 						stream << 'X';
 					else
-						stream << ge.haplotypes[i].solution[j];
+						stream << ge.haplotypes[i].solutionAt(j);
 				}
 				else
 					stream << '-';
@@ -628,30 +1640,29 @@ unique solution---all the reads on the correct side. That solution has a fixed M
 the other remain constant.
 */
     double retreat = 0.0;
-    static double prev_retreat_frac;
     int num_meta_iters = this->maxIterations/META_ITER;
 #define SMALL_RETREAT 0.01 // Let it grow with number of meta-iters? (0.01*(1+2*log(num_meta_iters)))
 #define FULL_RETREAT 0.94 // this needs to be less than (1-(REPORT_INTERVAL/2)) from the next line
     if(curIteration % (REPORT_INTERVAL/2) == 0) {
 	double factor = (double)windowMEC()/TARGET_MEC;
 	// double factor = (double)pmec()/(TARGET_MEC == 0 ? 0.5 : TARGET_MEC);
-	if(fracTime() - prev_retreat_frac > 2*SMALL_RETREAT &&
+	if(fracTime() - this->prevRetreatFrac > 2*SMALL_RETREAT &&
 	    (((fracTime()>0.3||pBad<0.2) && factor > 16) ||   // 14 to 22 seems to work well
 	     ((fracTime()>0.5||pBad<0.1) && factor >  8) )){  // quarter to half the above works well?
 	    retreat = factor * SMALL_RETREAT / meanCoverage() * log(num_meta_iters);
 	}
-	if(fracTime()>FULL_RETREAT && factor > 1.3) {//pmec() != 0){
+	if(fracTime()>FULL_RETREAT && factor > FULL_RETREAT_FACTOR) {//pmec() != 0){
 	    retreat = FULL_RETREAT;
 	    ResetBuffers();
 	}
 	if(retreat > 0.0) {
-	    cout << "Retreat " << 100*retreat << "% from " << 100 * fracTime();
+	    if (this->verbose) cout << "Retreat " << 100*retreat << "% from " << 100 * fracTime();
 	    this->curIteration -= retreat * this->maxIterations;
 	    assert(this->curIteration>=0);
-	    cout << "% to "  << 100 * fracTime() << "% because MEC is " << windowMEC();
-	    cout << ", too big by a factor of " << factor << "(" << TARGET_MEC << 
+	    if (this->verbose) cout << "% to "  << 100 * fracTime() << "% because MEC is " << windowMEC()
+			<< ", too big by a factor of " << factor << "(" << TARGET_MEC <<
 			", " << windowTotalCoverage() << ")" << endl;
-	    prev_retreat_frac = fracTime();
+	    this->prevRetreatFrac = fracTime();
 	}
     }
 #elif SCHEDULE==Betz
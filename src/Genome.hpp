@@ -7,9 +7,13 @@
 #include <sstream>
 #include <vector>
 #include <chrono>
+#include <cmath>
 #include <iomanip>
 #include "Haplotype.hpp"
+#include "ScoringModel.hpp"
+#include "SiteMatrix.hpp"
 #include "InputReader.hpp"
+#include "RateTree.hpp"
 #include "types.hpp"
 
 #define META_ITER 10000 // how many iterations per integer on the command line? 1M? 100k?
@@ -22,12 +26,19 @@ namespace SAHap {
 
 class Genome {
 public:
-	Genome(InputFile file);
+	/**
+	 * The model decides what optimize() minimizes; it must outlive the Genome
+	 */
+	Genome(InputFile file, const ScoringModel& model = ScoringModel::byName("MEC"));
+	Genome(InputFile file, const ScoringModel& model, unsigned long seed);
+	Genome(const Genome&) = delete; // haplotypes point into our SiteMatrix
+	Genome& operator=(const Genome&) = delete;
 	~Genome();
 	dnaweight_t mec();
 	dnaweight_t windowMEC();
 	double mecScore();
 	double windowMec();
+	const ScoringModel& scoringModel() const;
 	double score();
 	double score(dnaweight_t mec);
 	double meanCoverage();
@@ -37,12 +48,92 @@ public:
 	void shuffle();
 	bool done();
 	void setParameters(double tInitial, double tEnd, iteration_t maxIterations);
+	// Whether schedule changes (setParameters(), retreats) are reported; optimize() sets it from debug
+	void setVerbose(bool enabled) { this->verbose = enabled; }
+	double initialTemperature() const { return this->tInitial; }
+	double finalTemperature() const { return this->tInitial * exp(-this->tDecay); }
 	void setTemperature(double t);
 	void move();
 	void revertMove();
+
+	/**
+	 * The exact change in window cost if the read moved from one haplotype to another,
+	 * computed from the current counts without changing anything
+	 */
+	double deltaCost(dnacnt_t read, size_t from, size_t to);
+	void initializeWindow(unsigned windowSize);
+	void incrementWindow();
+
+	/**
+	 * Fixes a read on a haplotype for good: it keeps voting but is never moved
+	 */
+	void pin(dnacnt_t id, size_t haplotype);
+	bool isPinned(dnacnt_t id) const;
+	size_t haplotypeOf(dnacnt_t id) const;
+
+	/**
+	 * Ranges of overlapping reads found by optimize(), in matrix positions
+	 */
+	const vector<Range>& phasedBlocks() const;
+
 	void iteration();
 	void optimize(bool debug);
+
+	/**
+	 * Lets optimize() draw accepted moves directly (the n-fold way) while few moves are accepted
+	 */
+	void setRejectionFree(bool enabled);
+
+	/**
+	 * Whether optimize() fits each window's start temperature to its own cost changes,
+	 * rather than using the schedule from setParameters() everywhere (the default)
+	 */
+	void setWindowSchedules(bool enabled);
+
+	/**
+	 * optimize() moves on from a window once its MEC reaches the target late in the schedule,
+	 * or once its cost has not improved for this many iterations with almost no moves
+	 * accepted; 0, the default, always runs every window for the full number of iterations
+	 */
+	void setConvergenceHorizon(iteration_t iterations);
+
+	/**
+	 * How optimize() adjusts the temperature of a window:
+	 * - RETREAT: cools along the calibrated schedule, and sets the window back in time
+	 *            when its MEC is too far above the target
+	 * - LAM:     steers t by feedback so pBad follows a target curve (after Lam), and
+	 *            reheats a window that is stuck from the best state it has seen
+	 */
+	enum Schedule { RETREAT, LAM };
+	void setSchedule(Schedule schedule);
+
+	/**
+	 * Returns the schedule called name (retreat or lam); throws if there is none
+	 */
+	static Schedule scheduleByName(const string& name);
+
+	/**
+	 * Reads that share no sites can't affect each other, so optimize() anneals such
+	 * components on this many threads; 1 (the default) anneals the genome as a whole,
+	 * 0 uses every core
+	 */
+	void setThreads(unsigned threads);
+
+	/**
+	 * With more than one replica, optimize() runs parallel tempering: replicas of the
+	 * window anneal at fixed temperatures between those of the schedule, on up to
+	 * setThreads() threads, and neighbours swap states now and then
+	 */
+	void setReplicas(unsigned replicas);
+
+	/**
+	 * With more than one restart, optimize() anneals the input that many times from
+	 * different seeds, on up to setThreads() threads, and keeps the cheapest result
+	 * of each block
+	 */
+	void setRestarts(unsigned restarts);
 	void DynamicSchedule(double pBad, double TARGET_MEC);
+	void FeedbackSchedule(iteration_t iterations);
 
 	void Report(int seconds, bool final=false);
 	double findPbad(double temperature, iteration_t iterations = REPORT_INTERVAL);
@@ -85,6 +176,9 @@ public:
 
 protected:
 	InputFile file;
+	SiteMatrix matrix;
+	const ScoringModel * model;
+	unsigned long seed;
 	mt19937 randomEngine;
 	bool initialized = false;
 
@@ -97,11 +191,35 @@ protected:
 	double tDecay = 0.000001;
 	iteration_t maxIterations = 0;
 	iteration_t curIteration = 0;
+	// The schedule of the current window
+	bool windowSchedules = false;
+	double windowTInitial = 100000;
+	double windowTDecay = 0.000001;
+	iteration_t convergenceHorizon = 0;
+	Schedule schedule = RETREAT;
+	// The Lam schedule multiplies or divides t by lamStep every iteration, comparing pBadRecent
+	// (a running average of the pBad entries, the first lamSeen of them folded in) with its target
+	double lamStep = 1;
+	double pBadRecent = 1;
+	int lamSeen = 0;
 
 	Range range;
 
+	// assignment[read id] = index of the haplotype the read is currently on
+	vector<size_t> assignment;
+	// Reads that may be moved in the current window, and reads that lie (partly) ahead of it
+	vector<dnacnt_t> windowReads;
+	vector<dnacnt_t> pendingReads;
+	// pinned[read id] = haplotype the read may not leave, or -1; empty if nothing is pinned
+	vector<int> pinned;
+
 	dnapos_t numberOfSites = 0;
 	dnacnt_t increments = 0;
+	unsigned threads = 1;
+	unsigned replicas = 1;
+	unsigned restarts = 1;
+	bool verbose = true;
+	double prevRetreatFrac = 0;
 
 	double lastErrorRate = 1;
 	double lastCpuTime = 0;
@@ -109,14 +227,87 @@ protected:
 	// The last move performed
 	struct Move {
 		size_t from;
-		size_t to;
-		Read * read;
+		size_t to; // == from if there was nothing to move
+		dnacnt_t read;
 	};
 	Move lastMove;
 
+	// The lowest window cost since the window began, and the moves accepted since it was reached;
+	// once the log grows too long, bestWindow holds the haplotype of each window read at it instead
+	bool trackBest = false;
+	double bestSeenCost = 0;
+	vector<Move> undoLog;
+	vector<size_t> bestWindow;
+
+	// Rejection-free sampling: moveDelta[k * (ploidy - 1) + j] is the cost change of moving
+	// windowReads[k] to the j-th haplotype after the one it is on; kept only while deltasValid.
+	// moveRate holds their acceptances at rateTemperature (negative until set), and
+	// rateSquares the sum of their squares. byStart lists the indices of windowReads in order
+	// of read start, and windowSpan is the longest read among them, so a move finds the reads
+	// it overlaps without scanning the window.
+	bool rejectionFree = false;
+	bool rejectionFreeActive = false;
+	bool deltasValid = false;
+	vector<double> moveDelta;
+	RateTree moveRate;
+	double rateTemperature = -1;
+	double rateSquares = 0;
+	vector<size_t> byStart;
+	dnapos_t windowSpan = 0;
+
+	// The annealing loop, instantiated once per ScoringModel so the cost is never a
+	// virtual call, and per ploidy P (0 for any) so per-site loops have fixed bounds
+	template <class Model, unsigned P> void iterationWith();
+	template <class Model, unsigned P> void optimizeWith(bool debug);
+	template <class Model, unsigned P> double findPbadWith(double temperature, iteration_t iterations);
+	template <class Model, unsigned P> vector<double> uphillDeltasWith(size_t samples);
+	template <class Model, unsigned P> void calibrateWindowWith();
+	void startWindowSchedule();
+
+	/**
+	 * Best-so-far tracking while optimize() runs: logMove() is told of every accepted move and
+	 * the window cost after it, and restoreBest() undoes the moves made since the lowest cost
+	 */
+	void resetBest(double cost);
+	void logMove(const Move& m, double cost);
+	void restoreBest();
+	// Probes each temperature with findPbad() on its own copy of the reads, in parallel
+	vector<double> findPbads(const vector<double>& temperatures);
+	template <class Model, unsigned P> double deltaCostWith(dnacnt_t read, size_t from, size_t to) const;
+	template <class Model, unsigned P> iteration_t rejectionFreeStep(iteration_t limit);
+	template <class Model, unsigned P> void initMoveDeltas();
+	template <class Model, unsigned P> void updateMoveDeltas(Range touched);
+	template <class Model, unsigned P> void updateMoveDeltas(size_t k);
+	void refreshMoveRates();
+	template <unsigned P> void move();
+	template <unsigned P> Move pickMove();
+	template <unsigned P> void applyMove(const Move& m);
+	template <unsigned P> void revertMove();
+
 	double acceptance(double newScore, double curScore);
 	double getTemperature(iteration_t iteration);
 	dnacnt_t compareGroundTruth(const Haplotype& ch, const vector<int>& truth);
+	void pickReads(dnapos_t overlap);
+
+	/**
+	 * Read ids of each set of reads linked through shared sites, in order of their first read
+	 */
+	vector<vector<dnacnt_t>> components() const;
+	// Groups components into at most maxJobs jobs of similar size
+	vector<vector<dnacnt_t>> componentJobs(size_t maxJobs) const;
+	// The part of our input covered by the given reads, which must be in increasing id order
+	InputFile slice(const vector<dnacnt_t>& reads) const;
+	void optimizeComponents(const vector<vector<dnacnt_t>>& jobs, unsigned threads, bool debug);
+	template <class Model, unsigned P> void temperWith(unsigned threads, bool debug);
+	void optimizeRestarts(unsigned threads, bool debug);
+	// Takes the schedule and options of from, for a Genome that runs part of its work on one thread
+	void copySettings(const Genome& from);
+	// Our input with what annealing needs and nothing else; the reads share our arrays
+	InputFile sharedInput() const;
+	// Puts a read on another haplotype for good
+	void moveRead(dnacnt_t id, size_t to);
+	// Prints the outcome of a run whose reads were moved here from elsewhere
+	void finishMerged(int cpuSeconds, bool debug);
 	
 	friend ostream& operator << (ostream& stream, const Genome& ge);
 
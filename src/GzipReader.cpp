@@ -0,0 +1,146 @@
+#include "GzipReader.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <zlib.h>
+
+using namespace std;
+
+namespace SAHap {
+
+bool GzipReader::isGzip(const char * data, size_t size) {
+	return size >= 2 && (unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b;
+}
+
+GzipReader::GzipReader(const char * data, size_t size, size_t bufferBytes, unsigned buffers)
+	: input(data), inputSize(size), ring(max(2u, buffers)), filled(max(2u, buffers), 0)
+{
+	for (auto& slot : this->ring) slot.resize(bufferBytes);
+	this->worker = thread(&GzipReader::inflateAll, this);
+}
+
+GzipReader::~GzipReader() {
+	{
+		lock_guard<mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	this->changed.notify_all();
+	this->worker.join();
+}
+
+bool GzipReader::next(const char *& data, size_t& size) {
+	unique_lock<mutex> guard(this->lock);
+	if (this->consuming) {
+		// The caller is done with the previous slot; the worker may refill it
+		this->consuming = false;
+		this->changed.notify_all();
+	}
+	this->changed.wait(guard, [this]() { return this->count > 0 || this->finished; });
+	if (this->count == 0) {
+		if (this->error) throw this->error;
+		return false;
+	}
+
+	data = this->ring[this->head].data();
+	size = this->filled[this->head];
+	this->total += size;
+	this->head = (this->head + 1) % this->ring.size();
+	this->count--;
+	this->consuming = true;
+	return true;
+}
+
+// Runs on the worker thread
+void GzipReader::inflateAll() {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 32) != Z_OK) { // 32: expect a gzip header
+		lock_guard<mutex> guard(this->lock);
+		this->error = "Cannot initialize gzip decompression";
+		this->finished = true;
+		this->changed.notify_all();
+		return;
+	}
+
+	size_t fed = 0; // input bytes given to zlib; avail_in is only 32 bits wide
+	auto feed = [&]() {
+		if (zs.avail_in == 0 && fed < this->inputSize) {
+			size_t n = min(this->inputSize - fed, (size_t)UINT_MAX);
+			zs.next_in = (Bytef *)(this->input + fed);
+			zs.avail_in = n;
+			fed += n;
+		}
+	};
+
+	const char * error = nullptr;
+	bool done = false;
+	vector<char> leftover; // partial line carried to the next slot
+	size_t w = 0;
+
+	while (!done && !error) {
+		{
+			unique_lock<mutex> guard(this->lock);
+			this->changed.wait(guard, [this]() {
+				return this->count + (this->consuming ? 1 : 0) < this->ring.size() || this->stopping;
+			});
+			if (this->stopping) break;
+		}
+
+		// The slot is ours until it is published
+		vector<char>& slot = this->ring[w];
+		if (slot.size() < 2 * leftover.size()) slot.resize(2 * leftover.size());
+		copy(leftover.begin(), leftover.end(), slot.begin());
+		size_t used = leftover.size();
+
+		while (used < slot.size()) {
+			feed();
+			zs.next_out = (Bytef *)slot.data() + used;
+			zs.avail_out = slot.size() - used;
+			int ret = inflate(&zs, Z_NO_FLUSH);
+			used = slot.size() - zs.avail_out;
+
+			if (ret == Z_STREAM_END) {
+				feed();
+				// Another member may follow; anything else after the end is ignored, as gzip does
+				if (zs.avail_in >= 2 && isGzip((const char *)zs.next_in, zs.avail_in)) {
+					inflateReset(&zs);
+				} else {
+					done = true;
+					break;
+				}
+			} else if (ret == Z_BUF_ERROR && zs.avail_in == 0 && fed == this->inputSize) {
+				error = "Truncated gzip input";
+				break;
+			} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+				error = "Corrupt gzip input";
+				break;
+			}
+		}
+		if (error) break;
+
+		// Hand out whole lines only; a slot without any newline grows instead
+		size_t cut = used;
+		if (!done) {
+			while (cut > 0 && slot[cut - 1] != '\n') cut--;
+			if (cut == 0) {
+				leftover.assign(slot.begin(), slot.begin() + used);
+				continue;
+			}
+		}
+		leftover.assign(slot.begin() + cut, slot.begin() + used);
+
+		lock_guard<mutex> guard(this->lock);
+		this->filled[w] = cut;
+		this->count++;
+		w = (w + 1) % this->ring.size();
+		this->changed.notify_all();
+	}
+
+	inflateEnd(&zs);
+	lock_guard<mutex> guard(this->lock);
+	this->error = error;
+	this->finished = true;
+	this->changed.notify_all();
+}
+
+}
@@ -0,0 +1,67 @@
+#ifndef SAHAP_GZIPREADER_HPP
+#define SAHAP_GZIPREADER_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace SAHap {
+
+/*
+ * Inflates gzip data on a background thread into a ring of buffers, so the
+ * caller can parse one buffer while the next is being decompressed.
+ *
+ * Every buffer handed out ends at a line boundary: the partial line at the
+ * end of one buffer is moved to the front of the next. Concatenated gzip
+ * members (as written by bgzip or `cat a.gz b.gz`) are read back to back.
+ */
+class GzipReader {
+public:
+	/**
+	 * Returns true if data starts with the gzip magic bytes
+	 */
+	static bool isGzip(const char * data, size_t size);
+
+	GzipReader(const char * data, size_t size, size_t bufferBytes = 4 << 20, unsigned buffers = 4);
+	GzipReader(const GzipReader&) = delete;
+	GzipReader& operator=(const GzipReader&) = delete;
+	~GzipReader();
+
+	/**
+	 * Waits for the next buffer of whole lines; returns false once everything
+	 * was handed out. The buffer stays valid until the following call.
+	 */
+	bool next(const char *& data, size_t& size);
+
+	/**
+	 * Number of decompressed bytes handed out so far
+	 */
+	size_t bytesOut() const { return this->total; }
+
+private:
+	const char * input;
+	size_t inputSize;
+
+	vector<vector<char>> ring;
+	vector<size_t> filled; // bytes of whole lines in each slot
+	size_t head = 0; // next slot to hand out
+	size_t count = 0; // slots filled and not yet handed out
+	bool consuming = false; // the caller still holds the slot before head
+	bool finished = false;
+	bool stopping = false;
+	const char * error = nullptr;
+	size_t total = 0;
+
+	mutex lock;
+	condition_variable changed;
+	thread worker;
+
+	void inflateAll();
+};
+
+}
+
+#endif
@@ -9,37 +9,14 @@
 
 namespace SAHap {
 
-Haplotype::Haplotype(dnapos_t length, unsigned ploidyCount)
-	: length(length), total_mec(0), window_mec(0), isitecost(0)
+Haplotype::Haplotype(SiteMatrix * matrix, unsigned index, bool trackSiteCost, bool useWeights)
+	: length(matrix->size()), matrix(matrix), index(index), total_mec(0), window_mec(0), isitecost(0), trackSiteCost(trackSiteCost),
+	  useWeights(useWeights)
 {
-	this->ploidyCount = ploidyCount;
-	this->solution = vector<int>(this->length, -1);
-	this->weights = vector<vector<int>>(this->length);
-	this->siteCoverages = vector<dnacnt_t>(this->length);
+	this->ploidyCount = matrix->ploidyCount();
+	this->deltaCounts.resize(this->ploidyCount);
 	this->window.start = 0;
 	this->window.end = this->length;
-
-	for (dnapos_t i = 0; i < this->length; ++i) {
-		this->solution[i] = -1;
-		this->weights[i] = vector<int>(this->ploidyCount, 0);
-		this->siteCoverages[i] = 0;
-	}
-}
-
-Haplotype::Haplotype(const Haplotype& ch)
-	:
-		solution(ch.solution),
-		length(ch.length),
-		weights(ch.weights),
-		siteCoverages(ch.siteCoverages),
-		total_mec(ch.total_mec),
-		window_mec(ch.window_mec),
-		ploidyCount(ch.ploidyCount),
-		reads(ch.reads),
-		saved_reads(ch.saved_reads),
-		window(ch.window),
-		increment_window_by(ch.increment_window_by)
-{
 }
 
 Haplotype::~Haplotype() {
@@ -48,7 +25,7 @@ Haplotype::~Haplotype() {
 double Haplotype::meanCoverage() {
     double result = 0.0;
     for (dnapos_t i = 0; i < this->length; ++i) {
-		result += this->siteCoverages[i];
+		result += this->siteCoverage(i);
     }
     return result/this->length;
 }
@@ -58,19 +35,19 @@ dnapos_t Haplotype::size() const {
 }
 
 size_t Haplotype::numReads() const {
-	return this->reads.size();
+	return this->readCount;
 }
 
 double Haplotype::mec() {
 #if SAHAP_CHROMOSOME_DEBUG_MEC
 	double imec = 0;
 	for (dnapos_t i = 0; i < this->length; ++i) {
-		this->findSolution(i);
-		auto solution = this->solution[i]; // "majority" if ploidy==2 so "max"
-		if (solution != Allele::UNKNOWN) {
+		this->findSolution<0>(i);
+		auto solution = this->solution(i); // "majority" if ploidy==2 so "max"
+		if (solution >= 0) {
 			for (unsigned j = 0; j < ploidyCount; j++) {
-				if(j != this->solution[i]){
-					imec += this->weights[i][j];
+				if((int)j != solution){
+					imec += this->weights(i)[j];
 				}	
 			}
 		
@@ -90,13 +67,14 @@ double Haplotype::mec(dnapos_t s, dnapos_t e) {
     double out = 0;
     assert(e>=s);
 
-    for (unsigned j = 0; j < ploidyCount; j++) {
-	for (dnapos_t i = s; i <= e && i < this->length; i++) {
-	    if (solution[i] == (int)j) // solution is signed since (-1) is used to mean "undefined"
+    for (dnapos_t i = s; i <= e && i < this->length; i++) {
+	int * w = weights(i);
+	for (unsigned j = 0; j < ploidyCount; j++) {
+	    if (solution(i) == (int)j) // solution is signed since (-1) is used to mean "undefined"
 		continue;
-	    if(weights[i][j] < 0 && weights[i][j] > -SMALL_ENOUGH_TO_IGNORE) weights[i][j] = 0;
-	    assert(weights[i][j]>=0);
-	    out += weights[i][j];
+	    if(w[j] < 0 && w[j] > -SMALL_ENOUGH_TO_IGNORE) w[j] = 0;
+	    assert(w[j]>=0);
+	    out += w[j];
 	}
     }
     assert(out>=0);
@@ -108,60 +86,34 @@ double Haplotype::windowMec() {
 	return this->window_mec;
 }
 
-void Haplotype::saveReads() {
-	for (auto r : this->reads) {
-		if (r->range.end > this->window.start)
-			this->saved_reads.insert(r);
-	}
-}
-
-void Haplotype::pickReads(unsigned overlap) {
-	this->reads.clear();
-	
-	for (auto r : this->saved_reads) {
-		if (r->range.end > this->window.start + overlap && r->range.start <= this->window.end) {
-			this->reads.insert(r);
-		}
-	}
-	//cout << "MIN START: " << mx << endl;
-	for (auto r : this->reads)
-		this->saved_reads.erase(r);
-}
-
 void Haplotype::initializeWindow(unsigned windowSize, unsigned incrementBy) {
 	this->window.start = 0;
-	this->window.end = windowSize;
+	this->window.end = min((dnapos_t)windowSize, this->length);
 	this->increment_window_by = incrementBy;
-	this->saved_reads = this->reads;
-
-	this->pickReads(0);
 
 	this->window_mec = mec(this->window.start, this->window.end);
 }
 
 void Haplotype::incrementWindow() {
-	dnapos_t old_end = this->window.end;
-
 	this->window.start += this->increment_window_by;
 	this->window.end = min(this->window.end + this->increment_window_by, this->length);
 
-	this->saveReads();
-	this->pickReads(old_end - this->window.start);
-	
 	this->window_mec = mec(this->window.start, this->window.end);
 }
 
 double Haplotype::windowTotalCoverage() {
+    // Counted in weight, the unit of MEC; with unit weights this is the number of reads
     double result = 0.0;
     for (dnapos_t i = this->window.start; i < this->window.end; ++i) {
-		result += this->siteCoverages[i];
+		const int * w = weights(i);
+		for (unsigned j = 0; j < ploidyCount; j++) result += w[j];
     }
     return result;//(this->window.end - this->window.start);
 }
 
 void Haplotype::printCoverages() {
-	for (auto siteCoverage : siteCoverages) {
-		cerr << siteCoverage << " ";
+	for (dnapos_t i = 0; i < this->length; ++i) {
+		cerr << this->siteCoverage(i) << " ";
 	}
 	cerr << endl;
 }
@@ -172,51 +124,127 @@ double Haplotype::siteCost() {
 	return this->isitecost;
 }
 
-void Haplotype::add(Read * r) {
-	if (this->reads.find(r) != this->reads.end()) {
-		throw "Haplotype already contains read";
+double Haplotype::siteCost(dnapos_t start, dnapos_t end) {
+	this->batchRates.clear();
+	this->batchMecs.clear();
+	for (dnapos_t i = start; i <= end && i < this->length; i++) {
+		int coverage = siteCoverage(i);
+		if (!coverage) continue;
+		const int * w = weights(i);
+		for (unsigned j = 0; j < ploidyCount; j++) {
+			if (solution(i) == (int)j)
+				continue;
+			this->batchRates.push_back(READ_ERROR_RATE * coverage);
+			this->batchMecs.push_back(w[j]);
+		}
 	}
+
+	this->batchCosts.resize(this->batchRates.size());
+	log_poisson_1_cdf_batch(this->batchRates.data(), this->batchMecs.data(), this->batchCosts.data(), this->batchCosts.size());
+	double out = 0;
+	for (double c : this->batchCosts) out -= c;
+	return out;
+}
+
+template <unsigned P>
+void Haplotype::add(const Read& r) {
+	this->readCount++;
 	// std::cout << "adding\n";
-	this->reads.insert(r);
-	this->vote(*r);
+	this->vote<P>(r);
 }
 
-void Haplotype::remove(Read * r) {
-	if (this->reads.find(r) == this->reads.end()) {
-		cout << "Offending read is " << r << endl;
-		// cout << "Offending read has #sites=" << r->sites.size();
-		throw "Haplotype does not contain read";
-	}
+template <unsigned P>
+void Haplotype::remove(const Read& r) {
+	assert(this->readCount > 0);
+	this->readCount--;
+	this->vote<P>(r, true);
+}
 
-	this->reads.erase(r);
-	this->vote(*r, true);
+void Haplotype::add(const Read& r) {
+	switch (this->ploidyCount) {
+	case 2: this->add<2>(r); break;
+	case 3: this->add<3>(r); break;
+	case 4: this->add<4>(r); break;
+	case 6: this->add<6>(r); break;
+	default: this->add<0>(r); break;
+	}
 }
 
-Read * Haplotype::randomRead() {
-	long int seed = GetFancySeed(true);
-	cout << "Haplotype seed " << seed << endl;
-	mt19937 engine(seed);
+void Haplotype::remove(const Read& r) {
+	switch (this->ploidyCount) {
+	case 2: this->remove<2>(r); break;
+	case 3: this->remove<3>(r); break;
+	case 4: this->remove<4>(r); break;
+	case 6: this->remove<6>(r); break;
+	default: this->remove<0>(r); break;
+	}
+}
 
-	return this->randomRead(engine);
+bool Haplotype::isInRangeOf(Range r, dnapos_t pos) const {
+	return pos >= r.start && pos <= r.end;
 }
 
-Read * Haplotype::randomRead(mt19937& engine) {
-	if (this->reads.size()==0) return nullptr;
+template <unsigned P>
+void Haplotype::voteDelta(const Read& read, bool retract, double& windowMecDelta, double& siteCostDelta) const {
+	const PoissonTable& poisson = PoissonTable::shared();
+	unsigned n = ploidy<P>();
+	array<int, P ? P : 1> fixed;
+	int * w = P ? fixed.data() : this->deltaCounts.data();
+
+	for (Site site : read) {
+		dnapos_t pos = site.pos;
+		const int * cur = this->matrix->weights(pos, this->index);
+		int sol = this->matrix->solution(pos, this->index);
+		int coverage = this->matrix->coverage(pos, this->index);
+
+		// Replay addSite/removeSite on a copy of the counts
+		copy(cur, cur + n, w);
+		int newSol = sol;
+		int newCoverage;
+		if (!retract) {
+			w[site.value] += this->voteOf(site);
+			if (site.value != newSol && (newSol < 0 || w[site.value] > w[newSol]))
+				newSol = site.value;
+			newCoverage = coverage + 1;
+		} else {
+			w[site.value] -= this->voteOf(site);
+			if (newSol == site.value) {
+				for (unsigned i = 0; i < n; i++)
+					if (newSol < 0 ? w[i] > 0 : w[i] > w[newSol])
+						newSol = i;
+			}
+			newCoverage = coverage - 1;
+		}
 
-	uniform_int_distribution<size_t> distribution(0, this->reads.size() - 1);
-	size_t rd = distribution(engine);
-	return *next(begin(this->reads), rd);
-}
+		int mecBefore = 0, mecAfter = 0;
+		double costBefore = 0, costAfter = 0;
+		for (unsigned i = 0; i < n; i++) {
+			if ((int)i != sol) {
+				mecBefore += cur[i];
+				if (coverage && trackSiteCost) costBefore += poisson.cost(coverage, cur[i]);
+			}
+			if ((int)i != newSol) {
+				mecAfter += w[i];
+				if (newCoverage && trackSiteCost) costAfter += poisson.cost(newCoverage, w[i]);
+			}
+		}
 
-bool Haplotype::isInRangeOf(Range r, dnapos_t pos) {
-	return pos >= r.start && pos <= r.end;
+		if (isInRangeOf(window, pos))
+			windowMecDelta += mecAfter - mecBefore;
+		siteCostDelta += costAfter - costBefore;
+	}
 }
 
+template <unsigned P>
 void Haplotype::subtractMECValuesAt(dnapos_t pos) {
-	for (unsigned i = 0; i < ploidyCount; i++) {
-		if ((int)i == solution[pos])
+	const PoissonTable& poisson = PoissonTable::shared();
+	const int * w = weights(pos);
+	int sol = solution(pos);
+	int coverage = siteCoverage(pos);
+	for (unsigned i = 0; i < ploidy<P>(); i++) {
+		if ((int)i == sol)
 			continue;
-		auto mec = weights[pos][i];
+		auto mec = w[i];
 		total_mec -= mec;
 		assert(total_mec>=0);
 
@@ -225,15 +253,20 @@ void Haplotype::subtractMECValuesAt(dnapos_t pos) {
 		if(window_mec < 0 && window_mec > -SMALL_ENOUGH_TO_IGNORE) window_mec = 0;
 		assert(window_mec>=0);
 
-		if(siteCoverages[i]) isitecost -= -log_poisson_1_cdf(READ_ERROR_RATE * siteCoverages[i], mec);
+		if(coverage && trackSiteCost) isitecost -= poisson.cost(coverage, mec);
 	}
 }
 
+template <unsigned P>
 void Haplotype::addMECValuesAt(dnapos_t pos) {
-	for (unsigned i = 0; i < ploidyCount; i++) {
-		if ((int)i == solution[pos])
+	const PoissonTable& poisson = PoissonTable::shared();
+	const int * w = weights(pos);
+	int sol = solution(pos);
+	int coverage = siteCoverage(pos);
+	for (unsigned i = 0; i < ploidy<P>(); i++) {
+		if ((int)i == sol)
 			continue;
-		auto mec = weights[pos][i];
+		auto mec = w[i];
 		total_mec += mec;
 
 		if (isInRangeOf(window, pos))
@@ -241,51 +274,62 @@ void Haplotype::addMECValuesAt(dnapos_t pos) {
 		if(window_mec < 0 && window_mec > -SMALL_ENOUGH_TO_IGNORE) window_mec = 0;
 		assert(window_mec>=0);
 
-		if(siteCoverages[i]) isitecost += -log_poisson_1_cdf(READ_ERROR_RATE * siteCoverages[i], mec);
+		if(coverage && trackSiteCost) isitecost += poisson.cost(coverage, mec);
 	}
 }
 
 void Haplotype::addSite(const Site &s) {
-	weights[s.pos][s.value] += s.weight;
+	int * w = weights(s.pos);
+	int& sol = solution(s.pos);
+	w[s.value] += this->voteOf(s);
 
-	if (s.value != solution[s.pos] && weights[s.pos][s.value] > weights[s.pos][solution[s.pos]])
-		solution[s.pos] = s.value;
+	if (s.value != sol && (sol < 0 || w[s.value] > w[sol]))
+		sol = s.value;
 	
-	siteCoverages[s.pos]++;
+	siteCoverage(s.pos)++;
 }
 
+template <unsigned P>
 void Haplotype::removeSite(const Site &s) {
-	weights[s.pos][s.value] -= s.weight;
+	weights(s.pos)[s.value] -= this->voteOf(s);
 
-	if (solution[s.pos] == s.value)
-		findSolution(s.pos);
+	if (solution(s.pos) == s.value)
+		findSolution<P>(s.pos);
 
-	siteCoverages[s.pos]--;
+	siteCoverage(s.pos)--;
 }
 
-void Haplotype::vote(Read& read, bool retract) {
+template <unsigned P>
+void Haplotype::vote(const Read& read, bool retract) {
 #if SAHAP_CHROMOSOME_ALT_MEC
 	// TODO: Alternative MEC
 #else
-	for (const Site& site : read.sites) {
+	for (Site site : read) {
 		dnapos_t i = site.pos;
 
-		subtractMECValuesAt(i);
+		subtractMECValuesAt<P>(i);
 
 		if (!retract) // enter
 			addSite(site);
 		else // leave
-			removeSite(site);
+			removeSite<P>(site);
 
-		addMECValuesAt(i);
+		addMECValuesAt<P>(i);
 	}
 #endif
 }
 
+template <unsigned P>
 void Haplotype::findSolution(dnapos_t site) {
-	for (unsigned i = 0; i < ploidyCount; i++) 
-		if (weights[site][i] > weights[site][solution[site]])
-			solution[site] = i;
+	const int * w = weights(site);
+	int& sol = solution(site);
+	for (unsigned i = 0; i < ploidy<P>(); i++) 
+		if (sol < 0 ? w[i] > 0 : w[i] > w[sol])
+			sol = i;
+}
+
+int Haplotype::solutionAt(dnapos_t site) const {
+	return this->matrix->solution(site, this->index);
 }
 
 dnacnt_t& Haplotype::VoteInfo::vote(Allele allele) {
@@ -309,12 +353,24 @@ int& Haplotype::VoteInfo::weight(Allele allele) {
 ostream & operator << (ostream& stream, Haplotype& ch) {
 	stream << "ch[";
 	stream << "m=" << ch.length << ", ";
-	stream << "n=" << ch.reads.size() << ", ";
+	stream << "n=" << ch.readCount << ", ";
 	stream << "mec=" << ch.mec() << "] ";
 	for (dnapos_t i = 0; i < ch.size(); ++i) {
-		stream << ch.solution[i];
+		stream << ch.solutionAt(i);
 	}
 	return stream;
 }
 
+// Specialized kernels for the common ploidies; 0 is the generic fallback
+#define SAHAP_HAPLOTYPE_PLOIDY(P) \
+	template void Haplotype::add<P>(const Read& r); \
+	template void Haplotype::remove<P>(const Read& r); \
+	template void Haplotype::voteDelta<P>(const Read& r, bool retract, double& windowMecDelta, double& siteCostDelta) const;
+SAHAP_HAPLOTYPE_PLOIDY(0)
+SAHAP_HAPLOTYPE_PLOIDY(2)
+SAHAP_HAPLOTYPE_PLOIDY(3)
+SAHAP_HAPLOTYPE_PLOIDY(4)
+SAHAP_HAPLOTYPE_PLOIDY(6)
+#undef SAHAP_HAPLOTYPE_PLOIDY
+
 }
@@ -4,17 +4,23 @@
 #include <algorithm>
 #include <array>
 #include <vector>
-#include <unordered_set>
 #include <random>
 #include "types.hpp"
+#include "PoissonTable.hpp"
+#include "ReadStore.hpp"
+#include "SiteMatrix.hpp"
 #include "utils.hpp"
 
 namespace SAHap {
 
 class Haplotype {
 public:
-	Haplotype(dnapos_t length, unsigned ploidyCount);
-	Haplotype(const Haplotype& ch);
+	/**
+	 * A Haplotype is column `index` of a SiteMatrix shared with its siblings.
+	 * Without trackSiteCost, siteCost() stays 0 and votes skip the Poisson terms;
+	 * without useWeights, every allele votes 1 whatever weight its read gives it.
+	 */
+	Haplotype(SiteMatrix * matrix, unsigned index, bool trackSiteCost = true, bool useWeights = true);
 	~Haplotype();
 
 	double meanCoverage();
@@ -55,20 +61,33 @@ public:
 	double siteCost();
 
 	/**
-	 * Add a Read to this haplotype
+	 * Compute the site-based cost of sites start..end from scratch
+	 */
+	double siteCost(dnapos_t start, dnapos_t end);
+
+	/**
+	 * Add a Read to this haplotype; the caller (see Genome::assignment) knows it isn't here yet
+	 */
+	void add(const Read& r);
+
+	/**
+	 * Remove a Read from this haplotype; the caller knows it is here
 	 */
-	void add(Read * r);
+	void remove(const Read& r);
 
 	/**
-	 * Remove a Read to this haplotype
+	 * add() and remove() with the ploidy fixed at compile time, for hot loops.
+	 * P must equal the ploidy, or be 0 for any ploidy; 0, 2, 3, 4 and 6 are instantiated.
 	 */
-	void remove(Read * r);
+	template <unsigned P> void add(const Read& r);
+	template <unsigned P> void remove(const Read& r);
 
 	/**
-	 * Randomly pick a Read
+	 * Adds to windowMecDelta and siteCostDelta how windowMec() and siteCost() would
+	 * change if the read were added (or, with retract, removed), without changing
+	 * anything. Assumes a read covers each site at most once.
 	 */
-	Read * randomRead();
-	Read * randomRead(mt19937& engine);
+	template <unsigned P> void voteDelta(const Read& r, bool retract, double& windowMecDelta, double& siteCostDelta) const;
 
 	/**
 	 * Print chromosome
@@ -85,7 +104,10 @@ public:
 	 */
 	void incrementWindow();
 
-	vector<int> solution; // FIXME: is this a list of reads and which side they're on, or a list of sites with expected letter?
+	/**
+	 * Returns the allele this haplotype has at a site, or -1 if unknown
+	 */
+	int solutionAt(dnapos_t site) const;
 
 	friend ostream & operator << (ostream& stream, Haplotype& ch);
 
@@ -104,32 +126,45 @@ protected:
 
 	dnapos_t length;
 	// vector<VoteInfo> votes;
-	vector<vector<int>> weights;
-	vector<dnacnt_t> siteCoverages;
+	SiteMatrix * matrix;
+	unsigned index; // which haplotype of the matrix this is
 
 	double total_mec = 0; // cached MEC
 	double window_mec = 0; // cached current window's MEC
 	double isitecost = 0; // cached site-based cost
+	bool trackSiteCost = true;
+	bool useWeights = true;
 
 	unsigned ploidyCount;
 
-	unordered_set<Read *> reads;
-	unordered_set<Read *> saved_reads;
+	size_t readCount = 0;
+
+	// Scratch arrays for scoring many sites in one log_poisson_1_cdf_batch call
+	vector<double> batchRates;
+	vector<unsigned> batchMecs;
+	vector<double> batchCosts;
+	// Scratch counts for voteDelta<0>(), one per haplotype, so scoring a move never allocates
+	mutable vector<int> deltaCounts;
 
 	Range window;
 	unsigned increment_window_by;
 
-	void findSolution(dnapos_t site);
-	void vote(Read& read, bool retract=false);
-	void saveReads();
-	void pickReads(unsigned overlap);
+	// Per-site kernels, templated on ploidy as add<P>() is
+	template <unsigned P> unsigned ploidy() const { return P ? P : this->ploidyCount; }
+	template <unsigned P> void findSolution(dnapos_t site);
+	template <unsigned P> void vote(const Read& read, bool retract=false);
 
-	bool isInRangeOf(Range r, dnapos_t pos);
+	bool isInRangeOf(Range r, dnapos_t pos) const;
 
-	void subtractMECValuesAt(dnapos_t pos);
-	void addMECValuesAt(dnapos_t pos);
+	template <unsigned P> void subtractMECValuesAt(dnapos_t pos);
+	template <unsigned P> void addMECValuesAt(dnapos_t pos);
 	void addSite(const Site &s);
-	void removeSite(const Site &s);
+	template <unsigned P> void removeSite(const Site &s);
+
+	int voteOf(const Site& s) const { return this->useWeights ? s.weight : 1; }
+	int * weights(dnapos_t site) { return this->matrix->weights(site, this->index); }
+	int& solution(dnapos_t site) { return this->matrix->solution(site, this->index); }
+	int& siteCoverage(dnapos_t site) { return this->matrix->coverage(site, this->index); }
 };
 
 ostream & operator << (ostream& stream, Haplotype& ch);
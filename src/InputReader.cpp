@@ -1,164 +1,299 @@
 #include "InputReader.hpp"
+#include "GzipReader.hpp"
+#include "MappedFile.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// Input smaller than this per thread is not worth splitting
+#ifndef SAHAP_MIN_CHUNK_BYTES
+#define SAHAP_MIN_CHUNK_BYTES (4 << 20)
+#endif
+
+// Size of each decompressed buffer handed from the gzip thread to the parser
+#ifndef SAHAP_GZIP_BUFFER_BYTES
+#define SAHAP_GZIP_BUFFER_BYTES (4 << 20)
+#endif
 
 using namespace std;
 
 namespace SAHap {
 
-InputFile WIFInputReader::read(ifstream& file) {
-	InputFile result;
-	string buf;
+// The tokenizer works directly on the bytes of the file. A WIF line is a list of
+// sites separated by ':', each "<pos> <base> <allele> <weight>", optionally
+// followed by '#' and per-read annotations that we ignore.
+namespace {
 
-	dnacnt_t totalReadLength = 0;
-	
-	result.ploidy = 0;
-	while (!file.eof()) {
-		
-		getline(file, buf);
-		result.ploidy = max(WIFInputReader::getPloidy(buf)+1,result.ploidy);
+inline bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
 
-		
-		if (buf.size() == 0 || buf.find("#") == 0) continue;
+inline const char * skipBlanks(const char * p, const char * end) {
+	while (p < end && isBlank(*p)) ++p;
+	return p;
+}
 
-		Read read = WIFInputReader::parseRead(result.index, buf);
-		if (read.range.end - read.range.start < 1)
-			continue;
-		result.reads.push_back(read);
-		totalReadLength += read.range.end - read.range.start + 1;
+inline const char * skipToken(const char * p, const char * end) {
+	while (p < end && !isBlank(*p) && *p != ':') ++p;
+	return p;
+}
+
+inline const char * parseUnsigned(const char * p, const char * end, unsigned long& value) {
+	if (p == end || *p < '0' || *p > '9') throw "Malformed site in WIF input";
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p - '0');
+		++p;
 	}
-	result.averageReadLength = totalReadLength / result.reads.size();
+	return p;
+}
 
-	// std::cout << "Total: " << totalReadLength << std::endl;
-	// std::cout << "Average Read Length: " << result.averageReadLength << std::endl;
-	return result;
+// Parses the WIF line [p, eol) into sites, keeping genome positions, and
+// returns the range they span. Comment lines yield no sites.
+Range parseLine(const char * p, const char * eol, vector<Site>& sites, unsigned long& maxAllele) {
+	Range range;
+	sites.clear();
+	if (p < eol && *p == '#') return range;
+
+	while (true) {
+		p = skipBlanks(p, eol);
+		if (p == eol || *p == '#') break;
+
+		Site snp;
+		unsigned long pos, allele, weight;
+		p = parseUnsigned(p, eol, pos);
+		p = skipToken(skipBlanks(p, eol), eol); // base
+		p = parseUnsigned(skipBlanks(p, eol), eol, allele);
+		p = parseUnsigned(skipBlanks(p, eol), eol, weight);
+		while (p < eol && *p != ':') ++p;
+		if (p < eol) ++p;
+
+		maxAllele = max(maxAllele, allele);
+
+		snp.pos = pos;
+		snp.value = allele;
+		snp.weight = min(weight, (unsigned long)UINT8_MAX); // only weighted objectives use it
+
+		range.start = min(range.start, snp.pos);
+		range.end = max(range.end, snp.pos);
+		sites.push_back(snp);
+	}
+	return range;
 }
 
+// Reads with a single distinct site carry no phasing information
+inline bool isUsable(const vector<Site>& sites, Range range) {
+	return !sites.empty() && range.end - range.start >= 1;
+}
 
+}
 
-void WIFInputReader::readGroundTruth(ifstream& file, InputFile& parsed) {
-	// Obtain sorted list of sites covered
-	vector<dnapos_t> sites;
-	sites.reserve(parsed.index.size());
-	for (const auto& kv : parsed.index) {
-		sites.push_back(kv.first);
+InputFile WIFInputReader::read(const string& path, unsigned threads) {
+	auto start = chrono::steady_clock::now();
+	MappedFile file(path);
+	size_t textSize = file.size();
+	InputFile result;
+	if (GzipReader::isGzip(file.data(), file.size())) {
+		result = WIFInputReader::parseGzip(file.data(), file.size(), threads, &textSize);
+	} else {
+		result = WIFInputReader::parse(file.data(), file.size(), threads);
 	}
-	sort(sites.begin(), sites.end());
-	parsed.sites = sites;
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	double mb = textSize / 1e6;
 
-	string buf;
-	vector<vector<int>> truth;
-	truth.reserve(parsed.ploidy);
+	printf("Parsed %lu reads over %lu sites from %s: %.1f MB in %.3fs (%.1f MB/s)\n",
+		(unsigned long)result.reads.size(), (unsigned long)result.sites.size(), path.c_str(),
+		mb, seconds, seconds > 0 ? mb / seconds : 0.0);
+	return result;
+}
 
-	while (!file.eof()) {
-		getline(file, buf);
-		if (buf.size() == 0) continue;
-		vector<int> ch(parsed.index.size(), -1);
-		for (size_t i = 0; i < buf.size(); ++i) {
-			char allele = buf[i];
-			dnapos_t pos = sites[i];
-			dnapos_t matrixPos = parsed.index[pos];
-			if (allele == 'X') ch[matrixPos] = -1;
-			else ch[matrixPos] = allele - '0';
-			// else throw "Invalid ground truth allele value";
+// Parses whole lines in [begin, end), keeping genome positions; they are
+// compressed to matrix positions once every chunk's sites are known.
+void WIFInputReader::parseChunk(const char * begin, const char * end, Chunk& chunk) {
+	vector<Site> sites;
+	vector<dnapos_t> skipped;
+	const char * p = begin;
+
+	while (p < end) {
+		const char * eol = (const char *)memchr(p, '\n', end - p);
+		if (!eol) eol = end;
+
+		Range range = parseLine(p, eol, sites, chunk.maxAllele);
+		p = eol + 1;
+
+		if (!isUsable(sites, range)) {
+			// The read is dropped but its sites still get a column
+			for (const Site& s : sites) skipped.push_back(s.pos);
+			continue;
 		}
-		truth.push_back(ch);
+		chunk.reads.push_back(sites, range);
 	}
 
-	if (truth.size() != parsed.ploidy) {
-		cerr << "Warning: Number of haplotypes in ground truth does not match ploidy! Results will be meaningless." << endl;
+	chunk.sites = chunk.reads.distinctPositions();
+	chunk.sites.insert(chunk.sites.end(), skipped.begin(), skipped.end());
+	sort(chunk.sites.begin(), chunk.sites.end());
+	chunk.sites.erase(unique(chunk.sites.begin(), chunk.sites.end()), chunk.sites.end());
+}
+
+InputFile WIFInputReader::parse(const char * data, size_t size, unsigned threads) {
+	if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+	size_t numChunks = min((size_t)threads, max((size_t)1, size / SAHAP_MIN_CHUNK_BYTES));
+
+	// Split at line boundaries
+	vector<const char *> bounds(1, data);
+	const char * end = data + size;
+	for (size_t k = 1; k < numChunks; ++k) {
+		const char * p = max(bounds.back(), data + size * k / numChunks);
+		const char * eol = (const char *)memchr(p, '\n', end - p);
+		bounds.push_back(eol ? eol + 1 : end);
+	}
+	bounds.push_back(end);
+
+	vector<Chunk> chunks(numChunks);
+	vector<thread> workers;
+	for (size_t k = 0; k < numChunks; ++k) {
+		workers.push_back(thread([&bounds, &chunks, k]() {
+			try {
+				WIFInputReader::parseChunk(bounds[k], bounds[k + 1], chunks[k]);
+			} catch (const char * e) {
+				chunks[k].error = e;
+			}
+		}));
 	}
+	for (auto& w : workers) w.join();
 
-	parsed.groundTruth = truth;
-	parsed.hasGroundTruth = true;
+	return WIFInputReader::merge(chunks, threads);
 }
 
-Site WIFInputReader::parseSNP(string snp) {
-	istringstream iss(snp);
-	Site s;
-	iss >> s.pos;
+InputFile WIFInputReader::parseGzip(const char * data, size_t size, unsigned threads, size_t * textSize) {
+	// The worker inflates the next buffers while this thread parses the current one
+	GzipReader gz(data, size, SAHAP_GZIP_BUFFER_BYTES);
+	vector<Chunk> chunks;
+	const char * text;
+	size_t length;
+	while (gz.next(text, length)) {
+		chunks.push_back(Chunk());
+		WIFInputReader::parseChunk(text, text + length, chunks.back());
+	}
+	if (textSize) *textSize = gz.bytesOut();
 
-	iss.ignore(256, ' ');
-	iss.ignore(256, ' ');
+	if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+	return WIFInputReader::merge(chunks, threads);
+}
 
-	int weight, value;
-	iss >> value >> weight;
+InputFile WIFInputReader::merge(vector<Chunk>& chunks, unsigned threads) {
+	size_t numChunks = chunks.size();
+	threads = max(1u, min(threads, (unsigned)numChunks));
 
-	if (s.weight <= 0 || s.weight > 100) {
-	// 	s.weight = (double)weight/100;
-	// } else 
-		throw "Invalid weight value";
+	// The matrix position of a site is its rank among all sites, so matrix order
+	// is genomic order and does not depend on how the input was split.
+	InputFile result;
+	unsigned long maxAllele = 0;
+	for (size_t k = 0; k < numChunks; ++k) {
+		if (chunks[k].error) throw chunks[k].error;
+		maxAllele = max(maxAllele, chunks[k].maxAllele);
+		result.sites.insert(result.sites.end(), chunks[k].sites.begin(), chunks[k].sites.end());
+		chunks[k].sites = vector<dnapos_t>();
 	}
-	//s.weight = 1; // HACK
-	s.value = value;
-	// if (value == 0) {
-	// 	s.value = Allele::REF;
-	// } else if (value == 1) {
-	// 	s.value = Allele::ALT;
-	// } else {
-	// 	cout << value << endl;
-	// 	throw "Invalid allele value";
-	// }
-	return s;
-}
+	sort(result.sites.begin(), result.sites.end());
+	result.sites.erase(unique(result.sites.begin(), result.sites.end()), result.sites.end());
+
+	vector<thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.push_back(thread([&chunks, &result, t, threads]() {
+			for (size_t k = t; k < chunks.size(); k += threads) {
+				chunks[k].reads.compress(result.sites);
+			}
+		}));
+	}
+	for (auto& w : workers) w.join();
 
+	for (auto& chunk : chunks) {
+		result.reads.append(chunk.reads);
+		chunk.reads = ReadStore();
+	}
 
+	result.ploidy = maxAllele + 1;
+	WIFInputReader::finish(result);
 
-Read WIFInputReader::parseRead(unordered_map<dnapos_t, dnapos_t>& index, string line) {
-	Read result;
-	istringstream iss(line);
-	string buf;
-	while (getline(iss, buf, ':')) {
-		istringstream siss(buf);
-		char a;
-		siss >> a;
-		if (a == '#') break;
-
-		Site snp = WIFInputReader::parseSNP(buf);
-		if (index.find(snp.pos) == index.end()) {
-			// not a known site
-			dnapos_t matrixPos = index.size();
-			index.insert(make_pair(snp.pos, matrixPos));
-			snp.pos = matrixPos;
-		} else {
-			// known site
-			// index[actual pos] = matrix pos
-			snp.pos = index[snp.pos];
-		}
+	return result;
+}
 
-		result.range.start = min(result.range.start, snp.pos);
-		result.range.end = max(result.range.end, snp.pos);
+void WIFInputReader::finish(InputFile& result) {
+	if (result.reads.empty()) {
+		throw "No usable reads in WIF input";
+	}
 
-		result.sites.push_back(snp);
+	dnacnt_t totalReadLength = 0;
+	for (dnacnt_t id = 0; id < result.reads.size(); ++id) {
+		Range range = result.reads[id].range;
+		totalReadLength += range.end - range.start + 1;
 	}
+	result.averageReadLength = totalReadLength / result.reads.size();
+	result.reads.sortByStart();
+}
 
-	return result;
+WIFStreamReader::WIFStreamReader(const string& path)
+	: fp(path == "-" ? stdin : fopen(path.c_str(), "r"))
+{
+	if (!this->fp) {
+		throw "Cannot open input file";
+	}
 }
 
-dnacnt_t WIFInputReader::getPloidy(string line) {
-	int result = 0;
-	istringstream iss(line);
-	string buf;
-	while (getline(iss, buf, ':')) {
-		istringstream siss(buf);
-		char a;
-		siss >> a;
-		if (a == '#') break;
+WIFStreamReader::~WIFStreamReader() {
+	if (this->fp && this->fp != stdin) fclose(this->fp);
+	free(this->line);
+}
 
-		int throwaway;
+bool WIFStreamReader::next(vector<Site>& sites, Range& range) {
+	ssize_t n;
+	while ((n = getline(&this->line, &this->capacity, this->fp)) >= 0) {
+		const char * eol = this->line + n;
+		if (n > 0 && eol[-1] == '\n') --eol;
 
-		istringstream onesite(buf);
-		onesite >> throwaway;
+		range = parseLine(this->line, eol, sites, this->maxAllele);
+		this->bytes += n;
+		if (!isUsable(sites, range)) continue;
 
-		onesite.ignore(256, ' ');
-		onesite.ignore(256, ' ');
+		if (range.start < this->lastStart) {
+			throw "Streaming input must be sorted by the position of each read's first site";
+		}
+		this->lastStart = range.start;
+		return true;
+	}
+	if (ferror(this->fp)) {
+		throw "Error reading input file";
+	}
+	return false;
+}
 
-		int weight, value;
-		onesite >> value >> weight;
-		result = max(result,value);
+void WIFInputReader::readGroundTruth(ifstream& file, InputFile& parsed) {
+	// Column i of the ground truth is the i-th site in genomic order, which is matrix position i
+	string buf;
+	vector<vector<int>> truth;
+	truth.reserve(parsed.ploidy);
 
+	while (!file.eof()) {
+		getline(file, buf);
+		if (buf.size() == 0) continue;
+		vector<int> ch(parsed.sites.size(), -1);
+		for (size_t i = 0; i < buf.size() && i < ch.size(); ++i) {
+			char allele = buf[i];
+			if (allele == 'X') ch[i] = -1;
+			else ch[i] = allele - '0';
+			// else throw "Invalid ground truth allele value";
+		}
+		truth.push_back(ch);
 	}
-	return result;
-}
 
+	if (truth.size() != parsed.ploidy) {
+		cerr << "Warning: Number of haplotypes in ground truth does not match ploidy! Results will be meaningless." << endl;
+	}
 
+	parsed.groundTruth = truth;
+	parsed.hasGroundTruth = true;
+}
 
 }
@@ -2,27 +2,106 @@
 #define SAHAP_INPUTREADER_HPP
 
 #include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <vector>
-#include <unordered_set>
-#include <unordered_map>
 #include <utility>
 #include "types.hpp"
+#include "ReadStore.hpp"
 
 using namespace std;
 
 namespace SAHap {
 
+struct InputFile {
+	dnacnt_t ploidy;
+	vector<dnapos_t> sites; // sites[matrix pos] = genome pos, in genomic order
+	ReadStore reads; // sorted by start
+	vector<Zygosity> zygosity;
+	vector<vector<int>> groundTruth;
+	dnacnt_t groundTruthNotCovered = 0;
+	dnacnt_t averageReadLength = 0;
+	bool hasZygosity = false; // For MEC/GI and WMEC/GI
+	bool hasGroundTruth = false;
+};
+
 class WIFInputReader {
 public:
-	static InputFile read(ifstream& file);
+	/**
+	 * Maps the file at path ("-" for stdin) and parses it, reporting throughput.
+	 * Gzip-compressed files are recognized by their magic bytes.
+	 * threads = 0 uses every core.
+	 */
+	static InputFile read(const string& path, unsigned threads = 0);
+
+	/**
+	 * Parses WIF text, computing ploidy on the way. Matrix positions follow
+	 * genomic order. Large inputs are split at line boundaries and parsed on
+	 * several threads; the result is the same for any number of threads.
+	 */
+	static InputFile parse(const char * data, size_t size, unsigned threads = 1);
+
+	/**
+	 * Parses gzip-compressed WIF, decompressing on a background thread while
+	 * parsing, then merges on up to threads threads (0: every core).
+	 * Stores the decompressed size in textSize if given.
+	 */
+	static InputFile parseGzip(const char * data, size_t size, unsigned threads = 0, size_t * textSize = nullptr);
+
 	static void readGroundTruth(ifstream& file, InputFile& parsed);
-	static Site parseSNP(string snp);
-	// Map: actual pos -> matrix pos
-	static Read parseRead(unordered_map<dnapos_t, dnapos_t>& index, string line);
-	static dnacnt_t getPloidy(string line);
 
+	/**
+	 * Computes the average read length and sorts the reads of a freshly built input
+	 */
+	static void finish(InputFile& result);
+
+private:
+	// What one thread parsed out of its share of the input
+	struct Chunk {
+		ReadStore reads; // positions are still genome positions
+		vector<dnapos_t> sites; // sorted distinct positions seen, including on skipped reads
+		unsigned long maxAllele = 0;
+		const char * error = nullptr;
+	};
+
+	static void parseChunk(const char * begin, const char * end, Chunk& chunk);
+
+	// Numbers the sites of all chunks in genomic order and joins their reads
+	static InputFile merge(vector<Chunk>& chunks, unsigned threads);
+
+};
+
+/*
+ * Reads a WIF file (or "-" for stdin) one read at a time, without ever
+ * holding more than one line. Reads must come sorted by their first site.
+ */
+class WIFStreamReader {
+public:
+	WIFStreamReader(const string& path);
+	WIFStreamReader(const WIFStreamReader&) = delete;
+	WIFStreamReader& operator=(const WIFStreamReader&) = delete;
+	~WIFStreamReader();
+
+	/**
+	 * Fetches the next usable read, with genome positions; returns false at the end
+	 */
+	bool next(vector<Site>& sites, Range& range);
+
+	/**
+	 * Largest allele value seen so far
+	 */
+	unsigned long maxAlleleSeen() const { return this->maxAllele; }
+
+	size_t bytesRead() const { return this->bytes; }
+
+private:
+	FILE * fp;
+	char * line = nullptr;
+	size_t capacity = 0;
+	size_t bytes = 0;
+	unsigned long maxAllele = 0;
+	dnapos_t lastStart = 0;
 };
 
 }
@@ -0,0 +1,51 @@
+#include "MappedFile.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace SAHap {
+
+MappedFile::MappedFile(const string& path, bool sequential) {
+	int fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw "Cannot open input file";
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED) {
+			if (sequential) madvise(p, st.st_size, MADV_SEQUENTIAL);
+			this->mapping = p;
+			this->begin = (const char *)p;
+			this->length = st.st_size;
+		}
+	}
+	if (!this->mapping) {
+		this->slurp(fd);
+	}
+
+	if (fd != STDIN_FILENO) close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (this->mapping) {
+		munmap(this->mapping, this->length);
+	}
+}
+
+void MappedFile::slurp(int fd) {
+	char chunk[1 << 16];
+	ssize_t n;
+	while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+		this->buffer.insert(this->buffer.end(), chunk, chunk + n);
+	}
+	if (n < 0) {
+		throw "Error reading input file";
+	}
+	this->begin = this->buffer.data();
+	this->length = this->buffer.size();
+}
+
+}
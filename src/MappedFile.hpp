@@ -0,0 +1,39 @@
+#ifndef SAHAP_MAPPEDFILE_HPP
+#define SAHAP_MAPPEDFILE_HPP
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace SAHap {
+
+/*
+ * A read-only view of a whole file. Regular files are memory-mapped; anything
+ * that cannot be mapped (pipes, stdin as "-") is read into memory instead.
+ */
+class MappedFile {
+public:
+	/**
+	 * sequential hints the kernel that the file will be read once front to back
+	 */
+	MappedFile(const string& path, bool sequential = true);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	const char * data() const { return this->begin; }
+	size_t size() const { return this->length; }
+
+private:
+	const char * begin = nullptr;
+	size_t length = 0;
+	void * mapping = nullptr;
+	vector<char> buffer; // used when the file could not be mapped
+
+	void slurp(int fd);
+};
+
+}
+
+#endif
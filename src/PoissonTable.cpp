@@ -0,0 +1,23 @@
+#include "PoissonTable.hpp"
+
+extern int maxCoverageAssumption;
+
+namespace SAHap {
+
+PoissonTable::PoissonTable(unsigned maxCoverage, double errorRate)
+	: maxCoverage(maxCoverage), errorRate(errorRate), table((maxCoverage + 1) * (maxCoverage + 2) / 2, 0)
+{
+	// Coverage 0 has no cost; log_poisson_1_cdf needs a positive rate
+	for (unsigned c = 1; c <= maxCoverage; ++c) {
+		for (unsigned mec = 0; mec <= c; ++mec) {
+			this->table[c * (c + 1) / 2 + mec] = -log_poisson_1_cdf(errorRate * c, mec);
+		}
+	}
+}
+
+const PoissonTable& PoissonTable::shared() {
+	static const PoissonTable table(maxCoverageAssumption, READ_ERROR_RATE);
+	return table;
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef SAHAP_POISSONTABLE_HPP
+#define SAHAP_POISSONTABLE_HPP
+
+#include <vector>
+#include "types.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+namespace SAHap {
+
+/*
+ * The Poisson site cost -log_poisson_1_cdf(errorRate * coverage, mec), tabulated
+ * for every mec <= coverage <= maxCoverage. Entries are computed with
+ * log_poisson_1_cdf itself, so a lookup returns exactly what a call would;
+ * anything outside the table is computed on the spot.
+ */
+class PoissonTable {
+public:
+	PoissonTable(unsigned maxCoverage, double errorRate);
+
+	/**
+	 * The table for READ_ERROR_RATE and maxCoverageAssumption, built on first use
+	 */
+	static const PoissonTable& shared();
+
+	double cost(unsigned coverage, unsigned mec) const {
+		if (coverage <= this->maxCoverage && mec <= coverage) {
+			// Row c holds mec = 0..c and starts after the c rows before it
+			return this->table[coverage * (coverage + 1) / 2 + mec];
+		}
+		return -log_poisson_1_cdf(this->errorRate * coverage, mec);
+	}
+
+private:
+	unsigned maxCoverage;
+	double errorRate;
+	vector<double> table;
+};
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef SAHAP_RATETREE_HPP
+#define SAHAP_RATETREE_HPP
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+namespace SAHap {
+
+/*
+ * Non-negative rates in a Fenwick tree, for drawing an index with probability
+ * proportional to its rate.
+ *
+ * Changing one rate, the total and a draw each take O(log n); assign() builds
+ * the tree in O(n).
+ */
+class RateTree {
+public:
+	/**
+	 * Replaces every rate
+	 */
+	void assign(const vector<double>& rates) {
+		this->rates = rates;
+		this->tree.assign(rates.size() + 1, 0);
+		for (size_t i = 1; i <= rates.size(); ++i) {
+			this->tree[i] += rates[i - 1];
+			size_t up = i + (i & -i);
+			if (up <= rates.size()) this->tree[up] += this->tree[i];
+		}
+		this->top = 1;
+		while (this->top * 2 <= rates.size()) this->top *= 2;
+	}
+
+	void set(size_t i, double rate) {
+		double change = rate - this->rates[i];
+		this->rates[i] = rate;
+		for (size_t j = i + 1; j < this->tree.size(); j += j & -j) this->tree[j] += change;
+	}
+
+	double operator [] (size_t i) const { return this->rates[i]; }
+	size_t size() const { return this->rates.size(); }
+
+	double total() const {
+		double out = 0;
+		for (size_t j = this->rates.size(); j > 0; j -= j & -j) out += this->tree[j];
+		return out;
+	}
+
+	/**
+	 * The index whose share of the cumulative rates holds target, for target
+	 * in [0, total()); the last index for anything beyond
+	 */
+	size_t find(double target) const {
+		size_t pos = 0;
+		for (size_t step = this->top; step > 0; step /= 2) {
+			if (pos + step < this->tree.size() && this->tree[pos + step] <= target) {
+				pos += step;
+				target -= this->tree[pos];
+			}
+		}
+		return min(pos, this->rates.size() - 1);
+	}
+
+private:
+	vector<double> rates;
+	vector<double> tree; // tree[i] sums the rates i - (i & -i) .. i - 1
+	size_t top = 1; // the highest power of two no larger than size()
+};
+
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include "ReadStore.hpp"
+#include <algorithm>
+#include <numeric>
+
+namespace SAHap {
+
+ReadStore::ReadStore()
+	: buffer(make_shared<Buffer>())
+{
+	this->buffer->offsets.push_back(0);
+	this->bind();
+}
+
+ReadStore::ReadStore(const Arrays& arrays, shared_ptr<const void> backing)
+	: view(arrays), backing(backing)
+{
+}
+
+// Point the view at our buffer
+void ReadStore::bind() {
+	const Buffer& b = *this->buffer;
+	this->view.numReads = b.starts.size();
+	this->view.numEntries = b.pos.size();
+	this->view.offsets = b.offsets.data();
+	this->view.starts = b.starts.data();
+	this->view.ends = b.ends.data();
+	this->view.pos = b.pos.data();
+	this->view.allele = b.allele.data();
+	this->view.weight = b.weight.data();
+	this->backing.reset();
+}
+
+// Make sure no other store sees our arrays, copying them if need be, so they can be modified
+void ReadStore::own() {
+	if (this->buffer && this->buffer.use_count() == 1) return;
+	const Arrays& v = this->view;
+	auto b = make_shared<Buffer>();
+	b->offsets.assign(v.offsets, v.offsets + v.numReads + 1);
+	b->starts.assign(v.starts, v.starts + v.numReads);
+	b->ends.assign(v.ends, v.ends + v.numReads);
+	b->pos.assign(v.pos, v.pos + v.numEntries);
+	b->allele.assign(v.allele, v.allele + v.numEntries);
+	b->weight.assign(v.weight, v.weight + v.numEntries);
+	this->buffer = b;
+	this->bind();
+}
+
+void ReadStore::push_back(const vector<Site>& sites, Range range) {
+	this->own();
+	Buffer& b = *this->buffer;
+	if (range.end > UINT32_MAX) throw "Site position does not fit in the read store";
+	for (const Site& s : sites) {
+		if (s.pos > UINT32_MAX) throw "Site position does not fit in the read store";
+		if (s.value < 0 || s.value > UINT8_MAX) throw "Invalid allele value";
+		if (s.weight < 0 || s.weight > UINT8_MAX) throw "Invalid weight value";
+		b.pos.push_back((uint32_t)s.pos);
+		b.allele.push_back((uint8_t)s.value);
+		b.weight.push_back((uint8_t)s.weight);
+	}
+	b.offsets.push_back(b.pos.size());
+	b.starts.push_back(range.start);
+	b.ends.push_back(range.end);
+	this->bind();
+}
+
+void ReadStore::sortByStart() {
+	const Arrays& v = this->view;
+	vector<dnacnt_t> order(this->size());
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&v](dnacnt_t a, dnacnt_t b) {
+		return v.starts[a] < v.starts[b];
+	});
+
+	ReadStore sorted;
+	Buffer& b = *sorted.buffer;
+	b.offsets.reserve(v.numReads + 1);
+	b.starts.reserve(v.numReads);
+	b.ends.reserve(v.numReads);
+	b.pos.reserve(v.numEntries);
+	b.allele.reserve(v.numEntries);
+	b.weight.reserve(v.numEntries);
+
+	for (auto id : order) {
+		auto from = v.offsets[id], to = v.offsets[id + 1];
+		b.pos.insert(b.pos.end(), v.pos + from, v.pos + to);
+		b.allele.insert(b.allele.end(), v.allele + from, v.allele + to);
+		b.weight.insert(b.weight.end(), v.weight + from, v.weight + to);
+		b.offsets.push_back(b.pos.size());
+		b.starts.push_back(v.starts[id]);
+		b.ends.push_back(v.ends[id]);
+	}
+	sorted.bind();
+
+	*this = move(sorted);
+}
+
+vector<dnapos_t> ReadStore::distinctPositions() const {
+	vector<dnapos_t> out(this->view.pos, this->view.pos + this->view.numEntries);
+	sort(out.begin(), out.end());
+	out.erase(unique(out.begin(), out.end()), out.end());
+	return out;
+}
+
+void ReadStore::compress(const vector<dnapos_t>& sites) {
+	this->own();
+	Buffer& b = *this->buffer;
+	for (size_t r = 0; r < this->size(); ++r) {
+		Range range;
+		for (auto i = b.offsets[r]; i < b.offsets[r + 1]; ++i) {
+			b.pos[i] = lower_bound(sites.begin(), sites.end(), (dnapos_t)b.pos[i]) - sites.begin();
+			range.start = min(range.start, (dnapos_t)b.pos[i]);
+			range.end = max(range.end, (dnapos_t)b.pos[i]);
+		}
+		b.starts[r] = range.start;
+		b.ends[r] = range.end;
+	}
+}
+
+void ReadStore::append(const ReadStore& other) {
+	ReadStore keep(other); // in case other shares our buffer
+	this->own();
+	Buffer& b = *this->buffer;
+	const Arrays& o = keep.view;
+	auto base = b.pos.size();
+	b.pos.insert(b.pos.end(), o.pos, o.pos + o.numEntries);
+	b.allele.insert(b.allele.end(), o.allele, o.allele + o.numEntries);
+	b.weight.insert(b.weight.end(), o.weight, o.weight + o.numEntries);
+	for (size_t r = 1; r <= o.numReads; ++r) {
+		b.offsets.push_back(base + o.offsets[r]);
+	}
+	b.starts.insert(b.starts.end(), o.starts, o.starts + o.numReads);
+	b.ends.insert(b.ends.end(), o.ends, o.ends + o.numReads);
+	this->bind();
+}
+
+Read ReadStore::operator [] (dnacnt_t id) const {
+	const Arrays& v = this->view;
+	Read r;
+	auto from = v.offsets[id];
+	r.id = id;
+	r.range = Range(v.starts[id], v.ends[id]);
+	r.pos = v.pos + from;
+	r.allele = v.allele + from;
+	r.weight = v.weight + from;
+	r.length = v.offsets[id + 1] - from;
+	return r;
+}
+
+}
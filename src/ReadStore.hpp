@@ -0,0 +1,131 @@
+#ifndef SAHAP_READSTORE_HPP
+#define SAHAP_READSTORE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "types.hpp"
+
+namespace SAHap {
+
+/*
+ * A read as seen through a ReadStore: its range plus pointers to its sites.
+ * Iterating a Read yields Sites by value.
+ */
+struct Read {
+	dnacnt_t id = 0; // index into the ReadStore
+	Range range;
+	const uint32_t * pos = nullptr;
+	const uint8_t * allele = nullptr;
+	const uint8_t * weight = nullptr;
+	size_t length = 0;
+
+	struct const_iterator {
+		const Read * read;
+		size_t i;
+
+		Site operator * () const {
+			Site s;
+			s.pos = read->pos[i];
+			s.value = read->allele[i];
+			s.weight = read->weight[i];
+			return s;
+		}
+		const_iterator& operator ++ () { ++i; return *this; }
+		bool operator != (const const_iterator& other) const { return i != other.i; }
+	};
+
+	size_t size() const { return this->length; }
+	const_iterator begin() const { return const_iterator{this, 0}; }
+	const_iterator end() const { return const_iterator{this, this->length}; }
+};
+
+/*
+ * All reads of an input in one arena, as compressed-sparse-row arrays: the
+ * sites of read r are entries offsets[r] .. offsets[r+1]-1 of pos, allele and
+ * weight. After sortByStart() read ids follow the start of each read.
+ *
+ * The arrays either live in a buffer of the store's own or in memory owned by
+ * someone else, such as a mapped binary read-matrix file. Copies of a store
+ * share its buffer and keep it alive; a store only changes its arrays in place
+ * while it is the one store using them, and takes a private copy otherwise.
+ */
+class ReadStore {
+public:
+	// The raw CSR arrays, as laid out in memory or in a binary read-matrix file
+	struct Arrays {
+		size_t numReads = 0;
+		size_t numEntries = 0;
+		const uint64_t * offsets = nullptr; // numReads + 1 entries
+		const uint32_t * starts = nullptr;  // first matrix position of each read
+		const uint32_t * ends = nullptr;    // last matrix position of each read
+		const uint32_t * pos = nullptr;     // numEntries entries
+		const uint8_t * allele = nullptr;
+		const uint8_t * weight = nullptr;
+	};
+
+	ReadStore();
+
+	/**
+	 * Wraps arrays that belong to someone else; backing keeps them alive
+	 */
+	ReadStore(const Arrays& arrays, shared_ptr<const void> backing);
+
+	/**
+	 * Appends a read made of the given sites (positions are matrix positions)
+	 */
+	void push_back(const vector<Site>& sites, Range range);
+
+	/**
+	 * Renumbers the reads in order of their first site (ties keep input order)
+	 */
+	void sortByStart();
+
+	/**
+	 * Returns the sorted, distinct positions used by any read
+	 */
+	vector<dnapos_t> distinctPositions() const;
+
+	/**
+	 * Replaces every site position by its index in the sorted table `sites`
+	 * (which must contain it) and recomputes the read ranges
+	 */
+	void compress(const vector<dnapos_t>& sites);
+
+	/**
+	 * Appends all reads of another store after ours
+	 */
+	void append(const ReadStore& other);
+
+	Read operator [] (dnacnt_t id) const;
+	size_t size() const { return this->view.numReads; }
+	bool empty() const { return this->view.numReads == 0; }
+
+	/**
+	 * Total number of sites over all reads
+	 */
+	size_t numSites() const { return this->view.numEntries; }
+
+	const Arrays& arrays() const { return this->view; }
+
+private:
+	struct Buffer {
+		vector<uint64_t> offsets;
+		vector<uint32_t> starts;
+		vector<uint32_t> ends;
+		vector<uint32_t> pos;
+		vector<uint8_t> allele;
+		vector<uint8_t> weight;
+	};
+
+	Arrays view; // what every reader goes through
+	shared_ptr<Buffer> buffer; // what view points into, unless it is someone else's memory
+	shared_ptr<const void> backing; // that memory, while view points into it
+
+	void own();
+	void bind();
+};
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+#include "ScheduleCache.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+// Inputs share a schedule when their mean coverage and read length fall in the same bucket of
+// this relative width, and their number of sites in one of SITES_STEP; the temperatures follow
+// the sizes of the cost changes, which coverage and read length set
+#define SHAPE_STEP 0.05
+#define SITES_STEP 0.5
+
+namespace SAHap {
+
+namespace {
+
+// Rounds to a power of 1 + step, so inputs within about step / 2 of each other share a bucket
+double bucket(double x, double step) {
+	if (x <= 0) return 0;
+	return pow(1 + step, round(log(x) / log1p(step)));
+}
+
+}
+
+ScheduleCache::ScheduleCache(const string& path, bool recalibrate)
+	: path(path), recalibrate(recalibrate)
+{
+}
+
+string ScheduleCache::defaultPath() {
+	const char * path = getenv("SAHAP_SCHEDULE_CACHE");
+	return path ? path : "";
+}
+
+string ScheduleCache::fingerprint(const InputFile& file, const ScoringModel& model) {
+	double coverage = file.sites.empty() ? 0 : file.reads.numSites() / (double)file.sites.size();
+
+	ostringstream key;
+	key << setprecision(3) << model.name() << "/ploidy" << file.ploidy
+	    << "/coverage" << bucket(coverage, SHAPE_STEP) << "/readlength" << bucket(file.averageReadLength, SHAPE_STEP)
+	    << "/sites" << bucket(file.sites.size(), SITES_STEP);
+	return key.str();
+}
+
+bool ScheduleCache::lookup(const string& key, Schedule& out) const {
+	if (this->path.empty()) return false;
+	ifstream in(this->path);
+	bool found = false;
+	string line;
+	while (getline(in, line)) {
+		istringstream fields(line);
+		string k;
+		Schedule s;
+		// Lines we can't read are skipped, not fatal
+		if (fields >> k >> s.tInitial >> s.tEnd && k == key && s.tInitial > 0 && s.tEnd > 0) {
+			out = s;
+			found = true;
+		}
+	}
+	return found;
+}
+
+void ScheduleCache::store(const string& key, const Schedule& schedule) {
+	if (this->path.empty()) return;
+	ostringstream line;
+	line << setprecision(17) << key << " " << schedule.tInitial << " " << schedule.tEnd << "\n";
+
+	// One write per line, so concurrent runs appending to the file don't interleave
+	ofstream out(this->path, ios::app);
+	out << line.str() << flush;
+	if (!out) {
+		cerr << "Cannot write schedule cache " << this->path << endl;
+	}
+}
+
+void ScheduleCache::schedule(Genome& ge, const InputFile& file, iteration_t iterations) {
+	string key = fingerprint(file, ge.scoringModel());
+	Schedule s;
+	if (!this->recalibrate && this->lookup(key, s)) {
+		cout << "Using cached schedule for " << key << " from " << this->path << endl;
+		ge.setParameters(s.tInitial, s.tEnd, iterations);
+		return;
+	}
+
+	ge.autoSchedule(iterations);
+	s.tInitial = ge.initialTemperature();
+	s.tEnd = ge.finalTemperature();
+	this->store(key, s);
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef SAHAP_SCHEDULECACHE_HPP
+#define SAHAP_SCHEDULECACHE_HPP
+
+#include <string>
+#include "Genome.hpp"
+#include "InputReader.hpp"
+#include "ScoringModel.hpp"
+#include "types.hpp"
+
+using namespace std;
+
+namespace SAHap {
+
+/*
+ * Remembers calibrated temperature schedules in a text file, so inputs that
+ * look alike (same objective and ploidy, mean coverage and read length within
+ * about 5%, and a similar number of sites) skip Genome::autoSchedule() after
+ * the first one.
+ *
+ * Each line holds a fingerprint followed by tInitial and tEnd;
+ * new calibrations are appended and the last line for a fingerprint wins.
+ */
+class ScheduleCache {
+public:
+	struct Schedule {
+		double tInitial = 0;
+		double tEnd = 0;
+	};
+
+	/**
+	 * An empty path turns the cache off; with recalibrate, schedules are
+	 * calibrated afresh and the cache is only written
+	 */
+	ScheduleCache(const string& path, bool recalibrate = false);
+
+	/**
+	 * $SAHAP_SCHEDULE_CACHE if set, else empty: the cache is opt-in
+	 */
+	static string defaultPath();
+
+	/**
+	 * What inputs must share to share a schedule
+	 */
+	static string fingerprint(const InputFile& file, const ScoringModel& model);
+
+	bool lookup(const string& key, Schedule& out) const;
+	void store(const string& key, const Schedule& schedule);
+
+	/**
+	 * Gives ge the cached schedule for file, or calibrates it and caches the result
+	 */
+	void schedule(Genome& ge, const InputFile& file, iteration_t iterations);
+
+private:
+	string path;
+	bool recalibrate;
+};
+
+}
+
+#endif
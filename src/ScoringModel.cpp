@@ -0,0 +1,16 @@
+#include "ScoringModel.hpp"
+
+namespace SAHap {
+
+const ScoringModel& ScoringModel::byName(const string& name) {
+	static const MECModel mec;
+	static const PoissonModel poisson;
+	static const WMECModel wmec;
+
+	if (name == mec.name()) return mec;
+	if (name == poisson.name()) return poisson;
+	if (name == wmec.name()) return wmec;
+	throw "Unknown objective; choose MEC, Poisson or WMEC";
+}
+
+}
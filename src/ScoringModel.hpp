@@ -1,21 +1,137 @@
 #ifndef SAHAP_SCORINGMODEL_HPP
 #define SAHAP_SCORINGMODEL_HPP
 
+#include <string>
+#include <vector>
+#include "Haplotype.hpp"
+
+using namespace std;
+
 namespace SAHap {
 
 /*
- * A ScoringModel provides a score for a given solution.
- * It gets invoked whenever the Genome changes to automatically keep track of the score.
- * Multiple ScoringSystems may be attached to a Genome at once.
- * 
- * Two ScoringSystems are currently implemented:
- * - WMEC:        The Weighted Minimum Error Correction model
- * - GroundTruth: Difference from the ground truth
+ * A ScoringModel provides the score the annealer minimizes over the current window.
+ *
+ * Models are picked by name at run time, but the annealing loop is a template
+ * instantiated once per model (see Genome::optimize), which calls the static
+ * cost() of the concrete model directly. The virtual interface is only
+ * used outside the inner loop.
+ *
+ * Three ScoringModels are currently implemented:
+ * - MEC:     Minimum Error Correction; every allele on a read counts once
+ * - Poisson: -log of the chance of seeing at least the MEC of each site,
+ *            given Poisson read errors at READ_ERROR_RATE
+ * - WMEC:    Weighted MEC; every allele counts with the weight given in the input
  */
 class ScoringModel {
 public:
+	enum Kind { MEC, POISSON, WMEC };
+
+	virtual ~ScoringModel() {}
+	virtual Kind kind() const = 0;
+	virtual const char * name() const = 0;
+
+	/**
+	 * Whether alleles vote with the weights given in the input; otherwise every allele weighs 1
+	 */
+	virtual bool usesWeights() const = 0;
+
+	/**
+	 * Whether haplotypes must keep their Poisson site cost up to date
+	 */
+	virtual bool usesSiteCost() const = 0;
+
+	virtual double windowCost(vector<Haplotype>& haplotypes) const = 0;
+
+	/**
+	 * The cost of sites start .. end (inclusive), whatever the window
+	 */
+	virtual double rangeCost(vector<Haplotype>& haplotypes, Range range) const = 0;
+
+	/**
+	 * Returns the model called name; throws if there is none
+	 */
+	static const ScoringModel& byName(const string& name);
+};
+
+class MECModel final : public ScoringModel {
+public:
+	static constexpr bool WEIGHTED = false;
+	static constexpr bool SITE_COST = false;
+
+	static double cost(vector<Haplotype>& haplotypes) {
+		double out = 0;
+		for (auto& h : haplotypes) out += h.windowMec();
+		return out;
+	}
+
+	// How cost() changes, given the changes of the haplotypes' windowMec() and siteCost()
+	static double delta(double windowMecDelta, double siteCostDelta) { return windowMecDelta; }
+
+	Kind kind() const override { return MEC; }
+	const char * name() const override { return "MEC"; }
+	bool usesWeights() const override { return WEIGHTED; }
+	bool usesSiteCost() const override { return SITE_COST; }
+	double windowCost(vector<Haplotype>& haplotypes) const override { return cost(haplotypes); }
+
+	double rangeCost(vector<Haplotype>& haplotypes, Range range) const override {
+		double out = 0;
+		for (auto& h : haplotypes) out += h.mec(range.start, range.end);
+		return out;
+	}
+};
+
+class PoissonModel final : public ScoringModel {
+public:
+	static constexpr bool WEIGHTED = false;
+	static constexpr bool SITE_COST = true;
+
+	static double cost(vector<Haplotype>& haplotypes) {
+		double out = 0;
+		for (auto& h : haplotypes) out += h.siteCost();
+		return out;
+	}
+
+	static double delta(double windowMecDelta, double siteCostDelta) { return siteCostDelta; }
+
+	Kind kind() const override { return POISSON; }
+	const char * name() const override { return "Poisson"; }
+	bool usesWeights() const override { return WEIGHTED; }
+	bool usesSiteCost() const override { return SITE_COST; }
+	double windowCost(vector<Haplotype>& haplotypes) const override { return cost(haplotypes); }
+
+	double rangeCost(vector<Haplotype>& haplotypes, Range range) const override {
+		double out = 0;
+		for (auto& h : haplotypes) out += h.siteCost(range.start, range.end);
+		return out;
+	}
+};
+
+class WMECModel final : public ScoringModel {
+public:
+	static constexpr bool WEIGHTED = true;
+	static constexpr bool SITE_COST = false;
+
+	// The haplotypes already sum weights, so this is MEC over weighted votes
+	static double cost(vector<Haplotype>& haplotypes) {
+		return MECModel::cost(haplotypes);
+	}
+
+	static double delta(double windowMecDelta, double siteCostDelta) { return windowMecDelta; }
+
+	Kind kind() const override { return WMEC; }
+	const char * name() const override { return "WMEC"; }
+	bool usesWeights() const override { return WEIGHTED; }
+	bool usesSiteCost() const override { return SITE_COST; }
+	double windowCost(vector<Haplotype>& haplotypes) const override { return cost(haplotypes); }
+
+	double rangeCost(vector<Haplotype>& haplotypes, Range range) const override {
+		double out = 0;
+		for (auto& h : haplotypes) out += h.mec(range.start, range.end);
+		return out;
+	}
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
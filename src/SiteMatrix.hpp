@@ -0,0 +1,58 @@
+#ifndef SAHAP_SITEMATRIX_HPP
+#define SAHAP_SITEMATRIX_HPP
+
+#include <vector>
+#include "types.hpp"
+
+namespace SAHap {
+
+/*
+ * Vote counts of every haplotype at every site, in one contiguous block.
+ *
+ * The block is site-major: all haplotypes' cells for a site sit next to each
+ * other, so moving a read between haplotypes touches the same cache lines.
+ * A cell is `ploidy` allele weights followed by the winning allele (-1 if
+ * unknown) and the number of reads covering the site on that haplotype.
+ */
+class SiteMatrix {
+public:
+	SiteMatrix(dnapos_t length, unsigned ploidy)
+		: length(length), ploidy(ploidy), stride(ploidy + 2), data(length * ploidy * (ploidy + 2), 0)
+	{
+		this->reset();
+	}
+
+	/**
+	 * Clears all weights and coverages and forgets every solution
+	 */
+	void reset() {
+		fill(this->data.begin(), this->data.end(), 0);
+		for (dnapos_t i = 0; i < this->length; ++i) {
+			for (unsigned h = 0; h < this->ploidy; ++h) {
+				this->solution(i, h) = -1;
+			}
+		}
+	}
+
+	int * weights(dnapos_t site, unsigned hap) { return &this->data[this->cell(site, hap)]; }
+	const int * weights(dnapos_t site, unsigned hap) const { return &this->data[this->cell(site, hap)]; }
+	int& solution(dnapos_t site, unsigned hap) { return this->data[this->cell(site, hap) + this->ploidy]; }
+	int solution(dnapos_t site, unsigned hap) const { return this->data[this->cell(site, hap) + this->ploidy]; }
+	int& coverage(dnapos_t site, unsigned hap) { return this->data[this->cell(site, hap) + this->ploidy + 1]; }
+	int coverage(dnapos_t site, unsigned hap) const { return this->data[this->cell(site, hap) + this->ploidy + 1]; }
+
+	dnapos_t size() const { return this->length; }
+	unsigned ploidyCount() const { return this->ploidy; }
+
+private:
+	dnapos_t length;
+	unsigned ploidy;
+	unsigned stride;
+	vector<int> data;
+
+	size_t cell(dnapos_t site, unsigned hap) const { return (site * this->ploidy + hap) * this->stride; }
+};
+
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include "StreamPhaser.hpp"
+#include "utils.hpp"
+#include <cstdio>
+#include <limits>
+
+using namespace std;
+
+namespace SAHap {
+
+namespace {
+
+// Cut position meaning "everything buffered is finished"
+const dnapos_t NO_CUT = numeric_limits<dnapos_t>::max();
+
+}
+
+StreamPhaser::StreamPhaser(const string& path, const ScoringModel& model, iteration_t iterations, dnapos_t segmentSites, unsigned ploidy)
+	: reader(path), model(model), iterations(iterations), segmentSites(segmentSites), ploidy(ploidy)
+{
+	if (segmentSites == 0) {
+		throw "Segment size must be at least one site";
+	}
+	unsigned long seed = GetFancySeed(true);
+	cout << "Stream seed " << (long)seed << endl;
+	this->randomEngine = mt19937(seed);
+}
+
+void StreamPhaser::run(ostream& out) {
+	vector<Site> sites;
+	Range range;
+	dnacnt_t numReads = 0;
+
+	while (this->reader.next(sites, range)) {
+		if (!this->buffer.empty()) {
+			if (range.start > this->bufferedEnd && this->bufferedSites.size() >= this->segmentSites) {
+				this->phase(out, NO_CUT);
+			} else if (this->bufferedSites.size() >= 2 * this->segmentSites && range.start > this->emitFrom &&
+			           *this->bufferedSites.lower_bound(this->emitFrom) < range.start) {
+				this->phase(out, range.start);
+			}
+		}
+
+		this->buffer.push_back(sites, range);
+		for (const Site& s : sites) this->bufferedSites.insert(s.pos);
+		this->bufferedEnd = max(this->bufferedEnd, range.end);
+		numReads++;
+	}
+
+	if (numReads == 0) {
+		throw "No usable reads in WIF input";
+	}
+	this->phase(out, NO_CUT);
+
+	printf("Streamed %lu reads (%.1f MB) in %u blocks\n", numReads, this->reader.bytesRead() / 1e6, this->blockNum);
+}
+
+void StreamPhaser::phase(ostream& out, dnapos_t cut) {
+	if (this->ploidy == 0) {
+		this->ploidy = max(2ul, this->reader.maxAlleleSeen() + 1);
+	} else if (this->reader.maxAlleleSeen() >= this->ploidy) {
+		throw "Allele value out of range for the ploidy; pass a larger --ploidy";
+	}
+
+	InputFile file;
+	file.ploidy = this->ploidy;
+	file.reads = this->buffer;
+	file.sites = file.reads.distinctPositions();
+	file.reads.compress(file.sites);
+	// Reads are already in order of their first site, so sorting keeps the ids
+	WIFInputReader::finish(file);
+
+	Genome ge(file, this->model, this->randomEngine());
+	ge.setVerbose(false);
+	ge.setRejectionFree(this->rejectionFree);
+	ge.setWindowSchedules(this->windowSchedules);
+	ge.setConvergenceHorizon(this->convergenceHorizon);
+	ge.setSchedule(this->schedule);
+	ge.setThreads(this->threads);
+	ge.setReplicas(this->replicas);
+	ge.setRestarts(this->restarts);
+	for (dnacnt_t id = 0; id < this->carried.size(); ++id) {
+		ge.pin(id, this->carried[id]);
+	}
+
+	if (!this->calibrated) {
+		if (this->cache)
+			this->cache->schedule(ge, file, this->iterations);
+		else
+			ge.autoSchedule(this->iterations);
+		this->tInitial = ge.initialTemperature();
+		this->tEnd = ge.finalTemperature();
+		this->calibrated = true;
+	} else {
+		ge.setParameters(this->tInitial, this->tEnd, this->iterations);
+	}
+	ge.optimize(false);
+
+	this->printBlocks(out, ge, file, cut);
+
+	// Carry the reads that reach the cut, in genome positions, pinned where they are now
+	ReadStore next;
+	vector<size_t> nextCarried;
+	this->bufferedSites.clear();
+	this->bufferedEnd = 0;
+	if (cut != NO_CUT) {
+		for (dnacnt_t id = 0; id < this->buffer.size(); ++id) {
+			Read r = this->buffer[id];
+			if (r.range.end < cut) continue;
+
+			vector<Site> sites;
+			for (Site s : r) sites.push_back(s);
+			next.push_back(sites, r.range);
+			nextCarried.push_back(ge.haplotypeOf(id));
+			for (const Site& s : sites) this->bufferedSites.insert(s.pos);
+			this->bufferedEnd = max(this->bufferedEnd, r.range.end);
+		}
+	}
+	this->buffer = next;
+	this->carried = nextCarried;
+	this->emitFrom = cut == NO_CUT ? 0 : cut;
+	this->continuesBlock = cut != NO_CUT;
+}
+
+void StreamPhaser::printBlocks(ostream& out, const Genome& ge, const InputFile& file, dnapos_t cut) {
+	bool first = true;
+	for (Range r : ge.phasedBlocks()) {
+		// Matrix positions of this block that belong to this segment
+		dnapos_t from = r.start, to = r.end + 1;
+		while (from < to && file.sites[from] < this->emitFrom) from++;
+		while (to > from && file.sites[to - 1] >= cut) to--;
+		if (from == to) continue;
+
+		if (!(first && this->continuesBlock)) this->blockNum++;
+		first = false;
+
+		out << "BLOCK " << this->blockNum << " " << file.sites[from] << "-" << file.sites[to - 1] << endl;
+		for (size_t i = 0; i < ge.haplotypes.size(); ++i) {
+			for (dnapos_t j = from; j < to; ++j) {
+				if (ge.haplotypes[i].solutionAt(j) < 0)
+					out << 'X';
+				else
+					out << ge.haplotypes[i].solutionAt(j);
+			}
+			out << endl;
+		}
+	}
+	out.flush();
+}
+
+}
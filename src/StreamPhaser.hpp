@@ -0,0 +1,99 @@
+#ifndef SAHAP_STREAMPHASER_HPP
+#define SAHAP_STREAMPHASER_HPP
+
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "Genome.hpp"
+#include "InputReader.hpp"
+#include "ReadStore.hpp"
+#include "ScheduleCache.hpp"
+#include "types.hpp"
+
+using namespace std;
+
+namespace SAHap {
+
+/*
+ * Phases a sorted WIF stream a segment at a time, so memory depends on the
+ * segment size instead of the length of the genome.
+ *
+ * Reads are buffered until a block closes (no buffered read reaches the next
+ * read) and at least segmentSites sites are buffered; the buffer is then
+ * phased on its own and printed. If a block grows to twice segmentSites it is
+ * cut at the next read: sites before the cut are printed, and the reads that
+ * reach past it are carried into the next segment, pinned to the haplotype
+ * they ended up on, so the haplotypes keep their labels across the cut.
+ *
+ * The temperature schedule is calibrated on the first segment (or taken from
+ * the schedule cache) and reused. Segments are annealed quietly, each with a
+ * seed drawn from the one seed of the run, which is printed once.
+ */
+class StreamPhaser {
+public:
+	StreamPhaser(const string& path, const ScoringModel& model, iteration_t iterations, dnapos_t segmentSites, unsigned ploidy = 0);
+
+	/**
+	 * Phases the whole stream, writing every block to out as it is finished
+	 */
+	void run(ostream& out);
+
+	/**
+	 * Passed on to the Genome of every segment
+	 */
+	void setRejectionFree(bool enabled) { this->rejectionFree = enabled; }
+	void setWindowSchedules(bool enabled) { this->windowSchedules = enabled; }
+	void setConvergenceHorizon(iteration_t iterations) { this->convergenceHorizon = iterations; }
+	void setSchedule(Genome::Schedule schedule) { this->schedule = schedule; }
+	void setThreads(unsigned threads) { this->threads = threads; }
+	void setReplicas(unsigned replicas) { this->replicas = replicas; }
+	void setRestarts(unsigned restarts) { this->restarts = restarts; }
+
+	/**
+	 * Where the first segment looks up its schedule before calibrating; it must outlive us
+	 */
+	void setScheduleCache(ScheduleCache * cache) { this->cache = cache; }
+
+private:
+	WIFStreamReader reader;
+	const ScoringModel& model;
+	iteration_t iterations;
+	dnapos_t segmentSites;
+	unsigned ploidy;
+	bool rejectionFree = false;
+	bool windowSchedules = false;
+	iteration_t convergenceHorizon = 0;
+	Genome::Schedule schedule = Genome::RETREAT;
+	unsigned threads = 1;
+	unsigned replicas = 1;
+	unsigned restarts = 1;
+	mt19937 randomEngine;
+
+	// Reads waiting to be phased, in genome positions; the first carried.size() are pinned
+	ReadStore buffer;
+	vector<size_t> carried;
+	set<dnapos_t> bufferedSites;
+	dnapos_t bufferedEnd = 0;
+
+	// Sites before emitFrom were already printed by the previous segment
+	dnapos_t emitFrom = 0;
+	unsigned blockNum = 0;
+	bool continuesBlock = false;
+
+	ScheduleCache * cache = nullptr;
+	bool calibrated = false;
+	double tInitial = 0;
+	double tEnd = 0;
+
+	/**
+	 * Phases the buffer and prints its sites before cut; reads reaching cut are carried over
+	 */
+	void phase(ostream& out, dnapos_t cut);
+	void printBlocks(ostream& out, const Genome& ge, const InputFile& file, dnapos_t cut);
+};
+
+}
+
+#endif
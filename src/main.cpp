@@ -3,36 +3,165 @@
 #include <random>
 #include <cstdlib>
 #include "Genome.hpp"
+#include "BinaryInput.hpp"
+#include "ScheduleCache.hpp"
+#include "StreamPhaser.hpp"
 
 using namespace SAHap;
 using namespace std;
 
 int main(int argc, char *argv[]) {
 
-	if (argc < 2 || argc > 4) {
-		cerr << "Usage: " << argv[0] << " <reads> [gt] [millions of iterations = 10]" << endl;
-		return 1;
+	if (argc > 1 && string(argv[1]) == "convert") {
+		if (argc != 4) {
+			cerr << "Usage: " << argv[0] << " convert <reads.wif> <reads.bin>" << endl;
+			return 1;
+		}
+		try {
+			auto parsed = WIFInputReader::read(argv[2]);
+			BinaryInputReader::write(parsed, argv[3]);
+		} catch (const char* e) {
+			cerr << e << endl;
+			return 1;
+		}
+		return 0;
 	}
 
-	ifstream file;
-	file.open(argv[1]);
-	auto parsed = WIFInputReader::read(file); 
-
-	if (argc > 3) {
-		ifstream gtruth;
-		gtruth.open(argv[2]);
+	// The objective defaults to the suffix of the program name, so sahap.WMEC optimizes WMEC.
+	// sahap.Poisson has always optimized MEC (the old build flag never took effect), and the
+	// schedule is not tuned for the Poisson cost yet, so it still does; ask with --objective Poisson.
+	string program = argv[0];
+	string objective = program.find('.') != string::npos ? program.substr(program.rfind('.') + 1) : "MEC";
+	if (objective != "WMEC") objective = "MEC";
 
-		WIFInputReader::readGroundTruth(gtruth, parsed);
+	// Options come before the positional arguments
+	bool stream = false;
+	dnapos_t segmentSites = 20000;
+	unsigned ploidy = 0;
+	bool rejectionFree = false;
+	bool windowSchedules = false;
+	iteration_t convergeAfter = 0;
+	string schedule = "retreat";
+	unsigned threads = 1;
+	unsigned replicas = 1;
+	unsigned restarts = 1;
+	string scheduleCache = ScheduleCache::defaultPath();
+	bool recalibrate = false;
+	while (argc > 1 && argv[1][0] == '-' && argv[1][1] == '-') {
+		string opt = argv[1];
+		if (opt == "--stream") {
+			stream = true;
+		} else if (opt == "--segment-sites" && argc > 2) {
+			segmentSites = atol(argv[2]);
+			argv++; argc--;
+		} else if (opt == "--objective" && argc > 2) {
+			objective = argv[2];
+			argv++; argc--;
+		} else if (opt == "--threads" && argc > 2) {
+			threads = atoi(argv[2]);
+			argv++; argc--;
+		} else if (opt == "--replicas" && argc > 2) {
+			replicas = atoi(argv[2]);
+			argv++; argc--;
+		} else if (opt == "--restarts" && argc > 2) {
+			restarts = atoi(argv[2]);
+			argv++; argc--;
+		} else if (opt == "--schedule-cache" && argc > 2) {
+			scheduleCache = argv[2];
+			argv++; argc--;
+		} else if (opt == "--recalibrate") {
+			recalibrate = true;
+		} else if (opt == "--rejection-free") {
+			rejectionFree = true;
+		} else if (opt == "--window-schedules") {
+			windowSchedules = true;
+		} else if (opt == "--schedule" && argc > 2) {
+			schedule = argv[2];
+			argv++; argc--;
+		} else if (opt == "--converge-after" && argc > 2) {
+			convergeAfter = atoll(argv[2]);
+			argv++; argc--;
+		} else if (opt == "--ploidy" && argc > 2) {
+			ploidy = atoi(argv[2]);
+			argv++; argc--;
+		} else {
+			cerr << "Unknown option " << opt << endl;
+			return 1;
+		}
+		argv++; argc--;
 	}
 
+	if (argc < 2 || argc > 4 || (stream && argc > 3)) {
+		cerr << "Usage: " << argv[0] << " [--objective MEC|Poisson|WMEC] [options] <reads> [gt] [millions of iterations = 10]" << endl;
+		cerr << "       " << argv[0] << " [--objective ...] --stream [--segment-sites N] [--ploidy P] <reads.wif> [millions of iterations = 10]" << endl;
+		cerr << "       " << argv[0] << " convert <reads.wif> <reads.bin>" << endl;
+		cerr << "<reads> may be a WIF file or a binary read matrix made by convert" << endl;
+		cerr << "--stream phases a WIF file (or - for stdin) sorted by read start in bounded memory, printing each block" << endl;
+		cerr << "         as BLOCK n first-last (genome positions) and one row per haplotype over just its sites" << endl;
+		cerr << "--threads T parses the input, and anneals groups of reads that share no sites, on T threads (default 1, 0 for every core)" << endl;
+		cerr << "--replicas N anneals by parallel tempering with N replicas at fixed temperatures" << endl;
+		cerr << "--restarts N anneals N times from different seeds and keeps the best result of each block" << endl;
+		cerr << "--schedule-cache FILE remembers calibrated schedules in FILE (default $SAHAP_SCHEDULE_CACHE, or none)" << endl;
+		cerr << "--recalibrate calibrates the schedule even if a cached one fits" << endl;
+		cerr << "--rejection-free draws accepted moves directly once few moves are accepted" << endl;
+		cerr << "--window-schedules starts each window at a temperature fitted to its own moves instead of the calibrated one" << endl;
+		cerr << "--schedule retreat|lam cools by the calibrated schedule with retreats, or by feedback on pBad with reheats" << endl;
+		cerr << "--converge-after N ends a window once it has not improved for N iterations at near-zero acceptance (default 0: never end early)" << endl;
+		return 1;
+	}
 
+	ScheduleCache cache(scheduleCache, recalibrate);
+	const ScoringModel * model;
+	Genome::Schedule scheduleKind;
+	try {
+		model = &ScoringModel::byName(objective);
+		scheduleKind = Genome::scheduleByName(schedule);
+	} catch (const char* e) {
+		cerr << e << endl;
+		return 1;
+	}
 
+	if (stream) {
+		iteration_t iterations = argc == 3 ? atoi(argv[2]) * META_ITER : 10 * META_ITER;
+		try {
+			StreamPhaser phaser(argv[1], *model, iterations, segmentSites, ploidy);
+			phaser.setRejectionFree(rejectionFree);
+			phaser.setWindowSchedules(windowSchedules);
+			phaser.setConvergenceHorizon(convergeAfter);
+			phaser.setSchedule(scheduleKind);
+			phaser.setThreads(threads);
+			phaser.setReplicas(replicas);
+			phaser.setRestarts(restarts);
+			phaser.setScheduleCache(&cache);
+			phaser.run(cout);
+		} catch (const char* e) {
+			cerr << e << endl;
+			return 1;
+		}
+		return 0;
+	}
 
 	iteration_t iterations = argc == 4 ?  atoi(argv[3]) * META_ITER : 10 * META_ITER;
 	
 	try {
-		Genome ge(parsed);
-		ge.autoSchedule(iterations);
+		auto parsed = BinaryInputReader::isBinary(argv[1]) ? BinaryInputReader::read(argv[1]) : WIFInputReader::read(argv[1], threads);
+
+		if (argc > 3) {
+			ifstream gtruth;
+			gtruth.open(argv[2]);
+
+			WIFInputReader::readGroundTruth(gtruth, parsed);
+		}
+
+		Genome ge(parsed, *model);
+		ge.setRejectionFree(rejectionFree);
+		ge.setWindowSchedules(windowSchedules);
+		ge.setConvergenceHorizon(convergeAfter);
+		ge.setSchedule(scheduleKind);
+		ge.setThreads(threads);
+		ge.setReplicas(replicas);
+		ge.setRestarts(restarts);
+		cache.schedule(ge, parsed, iterations);
 			try {
 				ge.optimize(true);
 				cout << ge;
@@ -42,26 +42,6 @@ struct Range {
 	Range(dnapos_t a, dnapos_t b): start(a), end(b) {}
 };
 
-struct Read {
-	vector<Site> sites;
-	double cost = 0; // read-based cost (-log T_p(E_r, k_r))
-	
-	Range range;
-};
-
-struct InputFile {
-	dnacnt_t ploidy;
-	unordered_map<dnapos_t, dnapos_t> index; // index[matrix pos] = genome pos
-	vector<dnapos_t> sites;
-	vector<Read> reads;
-	vector<Zygosity> zygosity;
-	vector<vector<int>> groundTruth;
-	dnacnt_t groundTruthNotCovered = 0;
-	dnacnt_t averageReadLength = 0;
-	bool hasZygosity = false; // For MEC/GI and WMEC/GI
-	bool hasGroundTruth = false;
-};
-
 }
 
 #endif
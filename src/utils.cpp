@@ -87,6 +87,58 @@ double log_poisson_1_cdf(double l, unsigned k) {
   return r;
 }
 
+} // extern "C"
+
+namespace {
+
+// log k! for small k by summation, lgamma beyond
+const unsigned LOG_FACTORIAL_TABLE = 1024;
+
+struct LogFactorials {
+  double table[LOG_FACTORIAL_TABLE];
+  LogFactorials() {
+    table[0] = 0;
+    for (unsigned i = 1; i < LOG_FACTORIAL_TABLE; ++i) table[i] = table[i - 1] + log((double)i);
+  }
+};
+
+inline double log_factorial(unsigned k) {
+  static const LogFactorials f;
+  return k < LOG_FACTORIAL_TABLE ? f.table[k] : lgamma(k + 1.0);
+}
+
+inline double closed_pmf(double l, double logl, unsigned k) {
+  return -l + k * logl - log_factorial(k);
+}
+
+// The loop version walks up from k while the pmf grows. The pmf peaks at
+// floor(l) and falls off on both sides, so that walk ends at max(k, floor(l)).
+// Its (max == 1 && k < l) case cannot happen, as a log-probability is never 1.
+inline double closed_1_cdf(double l, unsigned k) {
+  assert(l > 0);
+  unsigned mode = (unsigned)l;
+  return closed_pmf(l, log(l), k > mode ? k : mode) / .894;
+}
+
+}
+
+extern "C" {
+
+double log_poisson_pmf_closed(double l, unsigned k) {
+  return closed_pmf(l, log(l), k);
+}
+
+double log_poisson_1_cdf_closed(double l, unsigned k) {
+  return closed_1_cdf(l, k);
+}
+
+// A plain loop over independent elements, so an optimizing build can vectorize it
+void log_poisson_1_cdf_batch(const double *l, const unsigned *k, double *out, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = closed_1_cdf(l[i], k[i]);
+  }
+}
+
 FILE *Popen(const char *cmd, const char *mode) {
 #if POPEN
     return popen(cmd, mode);